@@ -6,52 +6,374 @@
 #include <linux/device.h>
 #include <asm/uaccess.h>
 #include <linux/pagemap.h>
+#include <linux/highmem.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/sched/user.h>
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/capability.h>
 #include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include "sample_ioctl.h"
 
 static struct  class *sample_class;
 
+/*
+ * With contig=1 the pinned pages are mapped into one contiguous
+ * kernel virtual range, so the processing runs over the whole
+ * range at once instead of kmap()ing page by page.  A write()
+ * batch only needs it briefly and uses vm_map_ram(); registered
+ * buffers keep their mapping until they are released, which is
+ * what vmap() is for.
+ */
+static bool contig;
+module_param(contig, bool, 0644);
+MODULE_PARM_DESC(contig, "Map pinned pages contiguously");
+
+/*
+ * A buffer registered with SAMPLE_REGISTER stays pinned until
+ * SAMPLE_UNREGISTER or close(), so SAMPLE_PROCESS only looks up
+ * its page array instead of walking the page tables again.
+ * Like io_uring fixed buffers, the pinned pages are charged to
+ * the user's RLIMIT_MEMLOCK and the mm's pinned_vm meanwhile.
+ */
+#define SAMPLE_MAX_BUF_PAGES 16384
+
+struct sample_buf {
+	struct page **pages;
+	int nr_pages;
+	void *vaddr;		// vmap() of pages, if contig
+	unsigned long offset;	// of the buffer in pages[0]
+	size_t len;
+	struct user_struct *user;	// charged for nr_pages
+	struct mm_struct *mm;
+};
+
+struct sample_file {
+	struct mutex lock;
+	struct sample_buf bufs[SAMPLE_MAX_BUFS];
+};
+
+static void sample_buf_release(struct sample_buf *sb);
+
 static int sample_open(struct inode *inode, struct file *file)
 {
+	struct sample_file *sf;
 	printk(KERN_INFO "%s\n", __FUNCTION__);
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	mutex_init(&sf->lock);
+	file->private_data = sf;
 	return (0);
 }
 
 static int sample_release(struct inode *inode, struct file *file)
 {
+	struct sample_file *sf = file->private_data;
+	int i;
 	printk(KERN_INFO "%s\n", __FUNCTION__);
+	for (i = 0; i < SAMPLE_MAX_BUFS; i++)
+		sample_buf_release(&sf->bufs[i]);
+	kfree(sf);
 	return (0);
 
 }
 
-static ssize_t sample_write(struct file *file, const char __user *buf, size_t count, loff_t *off)
+/*
+ * Pin the user buffer in batches of SAMPLE_BATCH pages with the
+ * fast GUP path, which walks the page tables without taking
+ * mmap_sem as long as the pages are present.
+ */
+#define SAMPLE_BATCH 64
+
+static int sample_pin_pages(unsigned long start, int nr_pages,
+			    struct page **pages, bool longterm)
 {
-	int     res;
-	struct  page *page;
-	char    *myaddr;
-	printk(KERN_INFO "%s\n", __FUNCTION__);
-	down_read(&current->mm->mmap_sem);
-	res = get_user_pages((unsigned long)buf,
-			     1,
-			     1,
-			     &page, NULL);
-	if (res) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+	return pin_user_pages_fast(start, nr_pages,
+				   FOLL_WRITE | (longterm ? FOLL_LONGTERM : 0),
+				   pages);
+#else
+	return get_user_pages_fast(start, nr_pages, FOLL_WRITE, pages);
+#endif
+}
+
+static void sample_unpin_pages(struct page **pages, int nr_pages)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+	unpin_user_pages_dirty_lock(pages, nr_pages, true);
+#else
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+#endif
+}
+
+static u32 sample_csum(u32 csum, const u8 *p, size_t len)
+{
+	while (len--)
+		csum = (csum << 1 | csum >> 31) ^ *p++;
+	return csum;
+}
+
+/*
+ * Process len bytes mapped at myaddr.  first is set when they
+ * start at the beginning of the user buffer.
+ */
+static void sample_process_mapped(char *myaddr, size_t len, bool first,
+				  u32 *csum)
+{
+	if (first) {
 		printk(KERN_INFO "Got mmaped.\n");
-		myaddr = kmap(page);
-		printk(KERN_INFO "%s\n", myaddr);
+		printk(KERN_INFO "%.*s\n", (int)min_t(size_t, len, PAGE_SIZE), myaddr);
+	}
+	*csum = sample_csum(*csum, (u8 *)myaddr, len);
+	if (first && len > strlen("Mohan"))
 		strcpy(myaddr, "Mohan");
-		put_page(page);
+}
+
+// Same for len bytes that start at offset in pages[0], page by page
+static void sample_process(struct page **pages, unsigned long offset,
+			   size_t len, bool first, u32 *csum)
+{
+	size_t  n;
+	for (; len; pages++, offset = 0) {
+		n = min_t(size_t, PAGE_SIZE - offset, len);
+		sample_process_mapped(kmap(*pages) + offset, n, first, csum);
+		kunmap(*pages);
+		first = false;
+		len -= n;
 	}
-	up_read(&current->mm->mmap_sem);
-	return (0);
+}
+
+static void *sample_map(struct page **pages, int nr_pages)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	return vm_map_ram(pages, nr_pages, NUMA_NO_NODE);
+#else
+	return vm_map_ram(pages, nr_pages, NUMA_NO_NODE, PAGE_KERNEL);
+#endif
+}
+
+static ssize_t sample_write(struct file *file, const char __user *buf, size_t count, loff_t *off)
+{
+	unsigned long addr = (unsigned long)buf;
+	struct  page **pages;
+	size_t  done = 0;
+	size_t  len;
+	u32     csum = 0;
+	void    *vaddr;
+	int     res = 0;
+	int     nr;
+	printk(KERN_INFO "%s\n", __FUNCTION__);
+	if (!count)
+		return 0;
+	pages = kmalloc_array(SAMPLE_BATCH, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+	while (done < count) {
+		nr = min_t(size_t, SAMPLE_BATCH,
+			   DIV_ROUND_UP(offset_in_page(addr) + count - done, PAGE_SIZE));
+		res = sample_pin_pages(addr & PAGE_MASK, nr, pages, false);
+		if (res <= 0)
+			break;
+		len = min_t(size_t, (size_t)res * PAGE_SIZE - offset_in_page(addr),
+			    count - done);
+		vaddr = contig ? sample_map(pages, res) : NULL;
+		if (vaddr) {
+			sample_process_mapped(vaddr + offset_in_page(addr), len,
+					      !done, &csum);
+			vm_unmap_ram(vaddr, res);
+		} else {
+			sample_process(pages, offset_in_page(addr), len, !done, &csum);
+		}
+		sample_unpin_pages(pages, res);
+		done += len;
+		addr += len;
+		cond_resched();
+	}
+	kfree(pages);
+	if (!done)
+		return res ? res : -EFAULT;
+	printk(KERN_INFO "%zu bytes, checksum %08x\n", done, csum);
+	return (done);
+}
+
+// As io_account_mem(), CAP_IPC_LOCK is not limited
+static int sample_account_mem(struct user_struct *user, int nr_pages)
+{
+	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	unsigned long cur;
+	if (capable(CAP_IPC_LOCK)) {
+		atomic_long_add(nr_pages, &user->locked_vm);
+		return 0;
+	}
+	do {
+		cur = atomic_long_read(&user->locked_vm);
+		if (cur + nr_pages > limit)
+			return -ENOMEM;
+	} while (atomic_long_cmpxchg(&user->locked_vm, cur, cur + nr_pages) != cur);
+	return 0;
+}
+
+static void sample_unaccount_mem(struct sample_buf *sb)
+{
+	atomic_long_sub(sb->nr_pages, &sb->user->locked_vm);
+	atomic64_sub(sb->nr_pages, &sb->mm->pinned_vm);
+	free_uid(sb->user);
+	mmdrop(sb->mm);
+}
+
+static void sample_buf_release(struct sample_buf *sb)
+{
+	if (!sb->pages)
+		return;
+	if (sb->vaddr)
+		vunmap(sb->vaddr);
+	sample_unpin_pages(sb->pages, sb->nr_pages);
+	sample_unaccount_mem(sb);
+	kvfree(sb->pages);
+	memset(sb, 0, sizeof(*sb));
+}
+
+static long sample_register(struct sample_file *sf, struct sample_reg __user *arg)
+{
+	struct  sample_reg reg;
+	struct  sample_buf *sb = NULL;
+	unsigned long addr;
+	int     nr_pages;
+	int     pinned = 0;
+	int     res;
+	int     i;
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	addr = reg.addr;
+	if (!reg.len || addr + reg.len < addr)
+		return -EINVAL;
+	if (reg.len > (u64)SAMPLE_MAX_BUF_PAGES * PAGE_SIZE)
+		return -E2BIG;
+	nr_pages = DIV_ROUND_UP(offset_in_page(addr) + reg.len, PAGE_SIZE);
+	if (nr_pages > SAMPLE_MAX_BUF_PAGES)
+		return -E2BIG;
+	for (i = 0; i < SAMPLE_MAX_BUFS; i++) {
+		if (!sf->bufs[i].pages) {
+			sb = &sf->bufs[i];
+			break;
+		}
+	}
+	if (!sb)
+		return -ENOSPC;
+	res = sample_account_mem(current_user(), nr_pages);
+	if (res)
+		return res;
+	sb->pages = kvmalloc_array(nr_pages, sizeof(*sb->pages), GFP_KERNEL);
+	if (!sb->pages) {
+		atomic_long_sub(nr_pages, &current_user()->locked_vm);
+		return -ENOMEM;
+	}
+	while (pinned < nr_pages) {
+		res = sample_pin_pages((addr & PAGE_MASK) + pinned * PAGE_SIZE,
+				       min(nr_pages - pinned, SAMPLE_BATCH),
+				       sb->pages + pinned, true);
+		if (res <= 0) {
+			sample_unpin_pages(sb->pages, pinned);
+			atomic_long_sub(nr_pages, &current_user()->locked_vm);
+			kvfree(sb->pages);
+			sb->pages = NULL;
+			return res ? res : -EFAULT;
+		}
+		pinned += res;
+	}
+	sb->user = get_uid(current_user());
+	sb->mm = current->mm;
+	mmgrab(sb->mm);
+	atomic64_add(nr_pages, &sb->mm->pinned_vm);
+	sb->nr_pages = nr_pages;
+	sb->offset = offset_in_page(addr);
+	sb->len = reg.len;
+	// Fall back to kmap() if the vmalloc space is exhausted
+	if (contig)
+		sb->vaddr = vmap(sb->pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	printk(KERN_INFO "registered buffer %d: %d pages\n", i, nr_pages);
+	return i;
+}
+
+static long sample_process_buf(struct sample_file *sf, struct sample_op __user *arg)
+{
+	struct  sample_op op;
+	struct  sample_buf *sb;
+	unsigned long start;
+	u32     csum = 0;
+	if (copy_from_user(&op, arg, sizeof(op)))
+		return -EFAULT;
+	if (op.index >= SAMPLE_MAX_BUFS)
+		return -EINVAL;
+	sb = &sf->bufs[op.index];
+	if (!sb->pages)
+		return -ENOENT;
+	if (op.offset > sb->len || op.len > sb->len - op.offset)
+		return -EINVAL;
+	start = sb->offset + op.offset;
+	if (sb->vaddr) {
+		/*
+		 * Userspace writes through its own mapping in between,
+		 * keep the alias coherent on aliasing caches.
+		 */
+		invalidate_kernel_vmap_range(sb->vaddr + start, op.len);
+		sample_process_mapped(sb->vaddr + start, op.len, !op.offset, &csum);
+		flush_kernel_vmap_range(sb->vaddr + start, op.len);
+	} else {
+		sample_process(sb->pages + start / PAGE_SIZE, offset_in_page(start),
+			       op.len, !op.offset, &csum);
+	}
+	printk(KERN_INFO "%llu bytes, checksum %08x\n", op.len, csum);
+	return op.len;
+}
+
+static long sample_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct sample_file *sf = file->private_data;
+	long    ret;
+	mutex_lock(&sf->lock);
+	switch (cmd) {
+	case SAMPLE_REGISTER:
+		ret = sample_register(sf, (struct sample_reg __user *)arg);
+		break;
+	case SAMPLE_UNREGISTER:
+		if (arg >= SAMPLE_MAX_BUFS || !sf->bufs[arg].pages) {
+			ret = -EINVAL;
+			break;
+		}
+		sample_buf_release(&sf->bufs[arg]);
+		ret = 0;
+		break;
+	case SAMPLE_PROCESS:
+		ret = sample_process_buf(sf, (struct sample_op __user *)arg);
+		break;
+	default:
+		ret = -ENOTTY;
+	}
+	mutex_unlock(&sf->lock);
+	return ret;
 }
 
 static struct   file_operations sample_ops = {
 	.owner  = THIS_MODULE,
 	.open   = sample_open,
 	.release = sample_release,
-	.write  = sample_write
+	.write  = sample_write,
+	.unlocked_ioctl = sample_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+	// sample_ioctl.h only has fixed-size fields
+	.compat_ioctl = compat_ptr_ioctl,
+#endif
 };
 
 static int __init sample_init(void)
@@ -0,0 +1,29 @@
+// Sample device ioctls, shared with user_sample.c
+#ifndef __SAMPLE_IOCTL_H__
+#define __SAMPLE_IOCTL_H__
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define SAMPLE_MAX_BUFS 16
+
+// Pin a user buffer once, the ioctl returns its index
+struct sample_reg {
+	__u64 addr;
+	__u64 len;
+};
+
+// Process len bytes at offset of the registered buffer index
+struct sample_op {
+	__u32 index;
+	__u32 pad;
+	__u64 offset;
+	__u64 len;
+};
+
+#define SAMPLE_IOC_MAGIC	'S'
+#define SAMPLE_REGISTER		_IOW(SAMPLE_IOC_MAGIC, 1, struct sample_reg)
+#define SAMPLE_UNREGISTER	_IO(SAMPLE_IOC_MAGIC, 2)	// arg: index
+#define SAMPLE_PROCESS		_IOW(SAMPLE_IOC_MAGIC, 3, struct sample_op)
+
+#endif
@@ -3,18 +3,43 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "sample_ioctl.h"
 
-int main()
+int main(int argc, char **argv)
 {
 	int fd;
 	char *ptr;
+	size_t size = 4096;
+	ssize_t ret;
+	if (argc > 1)
+		size = strtoul(argv[1], NULL, 0);  //e.g. 4194304 for a 4MB write
 	fd = open("/dev/Sample", O_RDWR);
 	if (fd < 0) {
 		perror("error");
 	}
-	posix_memalign((void **)&ptr, 4096, 4096);
+	ret = posix_memalign((void **)&ptr, 4096, size);
+	if (ret) {
+		fprintf(stderr, "posix_memalign: %s\n", strerror(ret));
+		return 1;
+	}
+	memset(ptr, 0, size);
 	memcpy(ptr, "krishna", strlen("krishna"));  //Write String to Driver
-	write(fd, ptr, 4096);
+	ret = write(fd, ptr, size);
+	printf("wrote %zd of %zu bytes\n", ret, size);
 	printf("data is %s\n", ptr);   //Read Data from Driver
+
+	//Register the buffer once, then refer to it by index
+	struct sample_reg reg = { .addr = (unsigned long)ptr, .len = size };
+	int idx = ioctl(fd, SAMPLE_REGISTER, &reg);
+	if (idx < 0) {
+		perror("SAMPLE_REGISTER");
+	} else {
+		struct sample_op op = { .index = idx, .offset = 0, .len = size };
+		for (int i = 0; i < 3; i++)
+			printf("processed %d bytes\n", ioctl(fd, SAMPLE_PROCESS, &op));
+		ioctl(fd, SAMPLE_UNREGISTER, idx);
+	}
 	close(fd);
 }
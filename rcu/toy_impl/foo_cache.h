@@ -0,0 +1,16 @@
+#ifndef __FOO_CACHE_H_
+#define __FOO_CACHE_H_
+
+/*
+ * Dedicated slab cache for struct foo with a small per-CPU pool
+ * of recycled objects, see sample_foo_cache.c.
+ *
+ * Only free an object here once no reader can reference it
+ * anymore, i.e. after a grace period, exactly like kfree().
+ */
+int foo_cache_init(const char *name, size_t size);
+void foo_cache_exit(void);
+void *foo_cache_alloc(gfp_t gfp);
+void foo_cache_free(void *p);
+
+#endif
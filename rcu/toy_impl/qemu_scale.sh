@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Grace-period scaling test: boot a VM with more and more CPUs,
+# run bench.ko in it and collect the results.
+#
+#   toy_rcu.ko and bench.ko built with FLAVOR=tree (or another
+#   flavor to compare) against the guest kernel
+#   ./qemu_scale.sh <bzImage> <static busybox> [cpus...]
+#
+# e.g. ./qemu_scale.sh ~/linux/arch/x86/boot/bzImage /bin/busybox 16 64 256
+#
+# The guest kernel needs DEBUG_FS and enough NR_CPUS.  The output
+# of every run is kept in scale-<cpus>.log.
+#
+# The VM is a q35 machine with an interrupt-remapping IOMMU: more
+# than 255 CPUs need x2apic, which the guest only enables with
+# IRQ_REMAP and X86_X2APIC.
+
+if [ $# -lt 2 ]; then
+  echo "<Usage ./qemu_scale.sh bzImage busybox [cpus...]>"
+  exit 1
+fi
+
+kernel=$1
+busybox=$2
+shift 2
+cpus=${*:-"16 32 64 128 256"}
+mode=${MODE:-toy}
+duration=${DURATION:-10}
+
+if [ ! -e bench.ko ] || [ ! -e toy_rcu.ko ]; then
+  echo "bench.ko or toy_rcu.ko not found, build them first"
+  exit 1
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf $work' EXIT
+
+mkdir -p $work/root/bin $work/root/proc $work/root/sys
+cp $busybox $work/root/bin/busybox
+cp toy_rcu.ko bench.ko $work/root/
+for cmd in sh mount insmod cat grep sleep poweroff; do
+  ln -s busybox $work/root/bin/$cmd
+done
+
+cat > $work/root/init << EOF
+#!/bin/sh
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t debugfs debugfs /sys/kernel/debug
+insmod /toy_rcu.ko
+insmod /bench.ko mode=$mode nreaders=\$(grep -c ^processor /proc/cpuinfo) nwriters=1 pin=1 duration=$duration
+sleep $((duration + 2))
+cat /sys/kernel/debug/toy_rcu_bench/results
+cat /sys/kernel/debug/toy_rcu_bench/gp_latency
+poweroff -f
+EOF
+chmod +x $work/root/init
+
+(cd $work/root && find . | cpio -o -H newc 2>/dev/null | gzip) > $work/initrd.gz
+
+for n in $cpus; do
+  echo "--- $n CPUs ---"
+  qemu-system-x86_64 -enable-kvm -cpu host,+x2apic -smp $n -m 4G \
+    -machine q35,kernel-irqchip=split \
+    -device intel-iommu,intremap=on,eim=on \
+    -kernel $kernel -initrd $work/initrd.gz \
+    -append "console=ttyS0 quiet panic=-1" \
+    -nographic -no-reboot > scale-$n.log 2>&1
+  grep -E "updates/sec|reads/sec|^\[" scale-$n.log
+done
+exit 0
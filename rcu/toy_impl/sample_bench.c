@@ -0,0 +1,917 @@
+/* RCU read/update benchmark
+ *
+ * Runs the struct foo workload of sample_use.c in tight loops,
+ * without sleeping or printing between operations, with one of
+ * several synchronization schemes:
+ *
+ *   toy     - copy-update, toy_synchronize_rcu() (linked flavor)
+ *   toy_exp - copy-update, toy_synchronize_rcu_expedited()
+ *   rcu     - copy-update, synchronize_rcu()
+ *   rwlock  - in-place update under a rwlock
+ *   seqlock - in-place update under a seqlock, retrying readers
+ *   seqcount - in-place update of the whole struct foo under a
+ *             seqcount, serialized by the updaters' spinlock.
+ *             Nothing is allocated, readers retry.
+ *   hp      - copy-update, the old copy is retired to the hazard
+ *             pointers of toy_hp.h instead of waiting for a grace
+ *             period.  Always allocated with kmalloc().
+ *   ebr     - copy-update, the old copy is retired to the three-epoch
+ *             reclamation of toy_ebr.h.  Always allocated with
+ *             kmalloc().
+ *
+ * e.g. insmod toy_rcu.ko
+ *      insmod bench.ko mode=toy nreaders=8 nwriters=1 pin=1 duration=10
+ *
+ * Results are exported in /sys/kernel/debug/toy_rcu_bench/:
+ *   results    - reads/sec, updates/sec and allocations/sec
+ *   gp_latency - log2 histogram of the grace-period latency
+ *                seen by the updaters, in ns.  For hp and ebr, the
+ *                time from retiring an object to freeing it.
+ *   alloc_latency - log2 histogram of the struct foo allocation
+ *                latency of the copy-update modes, in ns.  Compare
+ *                slab=0 (kmalloc) with slab=1 (foo_cache.h).
+ *   read_latency - log2 histogram of the read-side latency,
+ *                sampled once every 1024 reads, in ns.  This
+ *                shows how much expedited grace periods disturb
+ *                the readers.
+ *   update_latency - log2 histogram of the whole update as seen
+ *                by the writers, grace period included, in ns.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/ktime.h>
+#include "toy_rcu.h"
+#include "foo_cache.h"
+#include "toy_hp.h"
+#include "toy_ebr.h"
+
+static char *mode = "toy";
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "toy, toy_exp, rcu, rwlock, seqlock, seqcount, hp or ebr");
+
+static int nreaders = 2;
+module_param(nreaders, int, 0444);
+MODULE_PARM_DESC(nreaders, "Number of reader threads");
+
+static int nwriters = 1;
+module_param(nwriters, int, 0444);
+MODULE_PARM_DESC(nwriters, "Number of writer threads");
+
+static bool pin;
+module_param(pin, bool, 0444);
+MODULE_PARM_DESC(pin, "Bind each thread to its own online CPU");
+
+static int duration = 10;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Benchmark duration in seconds");
+
+static bool slab;
+module_param(slab, bool, 0444);
+MODULE_PARM_DESC(slab, "Allocate struct foo from a dedicated cache with per-CPU recycling");
+
+struct foo {
+	int a;
+	char b;
+	long c;
+};
+
+struct bench_ops {
+	const char *name;
+	int (*init)(void);
+	void (*exit)(void);
+	int (*reader_init)(void);
+	void (*reader_exit)(void);
+	int (*read)(void);
+	void (*update)(int new_a);
+};
+
+struct bench_thread {
+	struct task_struct *task;
+	bool writer;
+	u64 ops;
+	u64 elapsed_ns;
+	bool done;
+	/* reader_init() failure, the thread did not run. */
+	int err;
+	int sink;
+};
+
+static struct bench_ops *cur_ops;
+static struct bench_thread *threads;
+static int nthreads;
+static struct dentry *bench_dir;
+
+#define BENCH_HIST_BUCKETS 64
+
+struct bench_hist {
+	atomic_long_t count[BENCH_HIST_BUCKETS];
+};
+
+static struct bench_hist gp_hist;
+static struct bench_hist read_hist;
+static struct bench_hist alloc_hist;
+static struct bench_hist update_hist;
+static DEFINE_PER_CPU(unsigned long, bench_allocs);
+
+static void bench_hist_record(struct bench_hist *h, u64 ns)
+{
+	int bucket = fls64(ns);
+
+	if (bucket >= BENCH_HIST_BUCKETS)
+		bucket = BENCH_HIST_BUCKETS - 1;
+	atomic_long_inc(&h->count[bucket]);
+}
+
+static void bench_gp_record(u64 ns)
+{
+	bench_hist_record(&gp_hist, ns);
+}
+
+static DEFINE_SPINLOCK(foo_mutex);
+
+static struct foo *bench_foo_alloc(void)
+{
+	struct foo *fp;
+	u64 t;
+
+	t = ktime_get_ns();
+	if (slab)
+		fp = foo_cache_alloc(GFP_KERNEL);
+	else
+		fp = kmalloc(sizeof(*fp), GFP_KERNEL);
+	bench_hist_record(&alloc_hist, ktime_get_ns() - t);
+	this_cpu_inc(bench_allocs);
+
+	return fp;
+}
+
+/* For the modes that need more than struct foo in the object. */
+static void *bench_kmalloc(size_t size)
+{
+	void *p;
+	u64 t;
+
+	t = ktime_get_ns();
+	p = kmalloc(size, GFP_KERNEL);
+	bench_hist_record(&alloc_hist, ktime_get_ns() - t);
+	this_cpu_inc(bench_allocs);
+
+	return p;
+}
+
+static void bench_foo_free(struct foo *fp)
+{
+	if (slab)
+		foo_cache_free(fp);
+	else
+		kfree(fp);
+}
+
+/* toy: the flavor of toy RCU linked into this module */
+
+static struct foo *toy_foo;
+
+static int toy_bench_init(void)
+{
+	toy_foo = bench_foo_alloc();
+	if (!toy_foo)
+		return -ENOMEM;
+
+	memset(toy_foo, 0, sizeof(*toy_foo));
+
+	return 0;
+}
+
+static void toy_bench_exit(void)
+{
+	bench_foo_free(toy_foo);
+}
+
+static int toy_bench_read(void)
+{
+	int retval;
+
+	toy_rcu_read_lock();
+	retval = toy_rcu_dereference(toy_foo)->a;
+	toy_rcu_read_unlock();
+	/* One read per loop iteration, see bench_thread_fn(). */
+	toy_rcu_quiescent_state();
+
+	return retval;
+}
+
+static void toy_bench_update_sync(int new_a, void (*sync)(void))
+{
+	struct foo *new_fp;
+	struct foo *old_fp;
+	u64 t;
+
+	new_fp = bench_foo_alloc();
+	if (!new_fp)
+		return;
+
+	spin_lock(&foo_mutex);
+	old_fp = toy_foo;
+	*new_fp = *old_fp;
+	new_fp->a = new_a;
+	toy_rcu_assign_pointer(toy_foo, new_fp);
+	spin_unlock(&foo_mutex);
+
+	t = ktime_get_ns();
+	sync();
+	bench_gp_record(ktime_get_ns() - t);
+
+	bench_foo_free(old_fp);
+}
+
+static void toy_bench_update(int new_a)
+{
+	toy_bench_update_sync(new_a, toy_synchronize_rcu);
+}
+
+static struct bench_ops toy_ops = {
+	.name		= "toy",
+	.init		= toy_bench_init,
+	.exit		= toy_bench_exit,
+	.reader_init	= toy_rcu_register_thread,
+	.reader_exit	= toy_rcu_unregister_thread,
+	.read		= toy_bench_read,
+	.update		= toy_bench_update,
+};
+
+/* toy_exp: same, forcing quiescent states with IPIs */
+
+static void toy_exp_bench_update(int new_a)
+{
+	toy_bench_update_sync(new_a, toy_synchronize_rcu_expedited);
+}
+
+static struct bench_ops toy_exp_ops = {
+	.name		= "toy_exp",
+	.init		= toy_bench_init,
+	.exit		= toy_bench_exit,
+	.reader_init	= toy_rcu_register_thread,
+	.reader_exit	= toy_rcu_unregister_thread,
+	.read		= toy_bench_read,
+	.update		= toy_exp_bench_update,
+};
+
+/* rcu: the real thing */
+
+static struct foo __rcu *rcu_foo;
+
+static int rcu_bench_init(void)
+{
+	struct foo *fp;
+
+	fp = bench_foo_alloc();
+	if (!fp)
+		return -ENOMEM;
+
+	memset(fp, 0, sizeof(*fp));
+
+	RCU_INIT_POINTER(rcu_foo, fp);
+
+	return 0;
+}
+
+static void rcu_bench_exit(void)
+{
+	bench_foo_free(rcu_dereference_protected(rcu_foo, 1));
+}
+
+static int rcu_bench_read(void)
+{
+	int retval;
+
+	rcu_read_lock();
+	retval = rcu_dereference(rcu_foo)->a;
+	rcu_read_unlock();
+
+	return retval;
+}
+
+static void rcu_bench_update(int new_a)
+{
+	struct foo *new_fp;
+	struct foo *old_fp;
+	u64 t;
+
+	new_fp = bench_foo_alloc();
+	if (!new_fp)
+		return;
+
+	spin_lock(&foo_mutex);
+	old_fp = rcu_dereference_protected(rcu_foo, lockdep_is_held(&foo_mutex));
+	*new_fp = *old_fp;
+	new_fp->a = new_a;
+	rcu_assign_pointer(rcu_foo, new_fp);
+	spin_unlock(&foo_mutex);
+
+	t = ktime_get_ns();
+	synchronize_rcu();
+	bench_gp_record(ktime_get_ns() - t);
+
+	bench_foo_free(old_fp);
+}
+
+static struct bench_ops rcu_ops = {
+	.name	= "rcu",
+	.init	= rcu_bench_init,
+	.exit	= rcu_bench_exit,
+	.read	= rcu_bench_read,
+	.update	= rcu_bench_update,
+};
+
+/* rwlock: in-place update, no grace period */
+
+static DEFINE_RWLOCK(foo_rwlock);
+static struct foo rwlock_foo;
+
+static int rwlock_bench_read(void)
+{
+	int retval;
+
+	read_lock(&foo_rwlock);
+	retval = rwlock_foo.a;
+	read_unlock(&foo_rwlock);
+
+	return retval;
+}
+
+static void rwlock_bench_update(int new_a)
+{
+	write_lock(&foo_rwlock);
+	rwlock_foo.a = new_a;
+	write_unlock(&foo_rwlock);
+}
+
+static struct bench_ops rwlock_ops = {
+	.name	= "rwlock",
+	.read	= rwlock_bench_read,
+	.update	= rwlock_bench_update,
+};
+
+/* seqlock: in-place update, readers retry */
+
+static DEFINE_SEQLOCK(foo_seqlock);
+static struct foo seqlock_foo;
+
+static int seqlock_bench_read(void)
+{
+	unsigned int seq;
+	int retval;
+
+	do {
+		seq = read_seqbegin(&foo_seqlock);
+		retval = seqlock_foo.a;
+	} while (read_seqretry(&foo_seqlock, seq));
+
+	return retval;
+}
+
+static void seqlock_bench_update(int new_a)
+{
+	write_seqlock(&foo_seqlock);
+	seqlock_foo.a = new_a;
+	write_sequnlock(&foo_seqlock);
+}
+
+static struct bench_ops seqlock_ops = {
+	.name	= "seqlock",
+	.read	= seqlock_bench_read,
+	.update	= seqlock_bench_update,
+};
+
+/* seqcount: in-place update of the whole struct, readers retry */
+
+static seqcount_spinlock_t foo_seqcount =
+	SEQCNT_SPINLOCK_ZERO(foo_seqcount, &foo_mutex);
+static struct foo seqcount_foo;
+
+static int seqcount_bench_read(void)
+{
+	struct foo snap;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&foo_seqcount);
+		snap = seqcount_foo;
+	} while (read_seqcount_retry(&foo_seqcount, seq));
+
+	return snap.a + snap.b + snap.c;
+}
+
+static void seqcount_bench_update(int new_a)
+{
+	spin_lock(&foo_mutex);
+	write_seqcount_begin(&foo_seqcount);
+	seqcount_foo.a = new_a;
+	seqcount_foo.b = new_a;
+	seqcount_foo.c = new_a;
+	write_seqcount_end(&foo_seqcount);
+	spin_unlock(&foo_mutex);
+}
+
+static struct bench_ops seqcount_ops = {
+	.name	= "seqcount",
+	.read	= seqcount_bench_read,
+	.update	= seqcount_bench_update,
+};
+
+/* hp: copy-update, reclaimed through hazard pointers */
+
+struct hp_foo {
+	struct foo foo;
+	struct toy_hp_head hp;
+	u64 retired_ns;
+};
+
+static struct hp_foo *hp_foo;
+
+static void hp_foo_reclaim(struct toy_hp_head *head)
+{
+	struct hp_foo *fp = container_of(head, struct hp_foo, hp);
+
+	bench_gp_record(ktime_get_ns() - fp->retired_ns);
+	kfree(fp);
+}
+
+static int hp_bench_init(void)
+{
+	int err;
+
+	err = toy_hp_init();
+	if (err)
+		return err;
+
+	hp_foo = bench_kmalloc(sizeof(struct hp_foo));
+	if (!hp_foo) {
+		toy_hp_exit();
+		return -ENOMEM;
+	}
+
+	memset(hp_foo, 0, sizeof(*hp_foo));
+
+	return 0;
+}
+
+static void hp_bench_exit(void)
+{
+	kfree(hp_foo);
+	toy_hp_exit();
+}
+
+static int hp_bench_read(void)
+{
+	struct hp_foo *fp;
+	int retval;
+
+	fp = toy_hp_protect(0, &hp_foo);
+	retval = fp->foo.a;
+	toy_hp_clear(0);
+
+	return retval;
+}
+
+static void hp_bench_update(int new_a)
+{
+	struct hp_foo *new_fp;
+	struct hp_foo *old_fp;
+
+	new_fp = bench_kmalloc(sizeof(struct hp_foo));
+	if (!new_fp)
+		return;
+
+	spin_lock(&foo_mutex);
+	old_fp = hp_foo;
+	new_fp->foo = old_fp->foo;
+	new_fp->foo.a = new_a;
+	smp_store_release(&hp_foo, new_fp);
+	spin_unlock(&foo_mutex);
+
+	old_fp->retired_ns = ktime_get_ns();
+	toy_hp_retire(&old_fp->hp, old_fp, hp_foo_reclaim);
+}
+
+static struct bench_ops hp_ops = {
+	.name	= "hp",
+	.init	= hp_bench_init,
+	.exit	= hp_bench_exit,
+	.read	= hp_bench_read,
+	.update	= hp_bench_update,
+};
+
+/* ebr: copy-update, reclaimed through epochs */
+
+struct ebr_foo {
+	struct foo foo;
+	struct rcu_head rcu;
+	u64 retired_ns;
+};
+
+static struct ebr_foo *ebr_foo;
+
+static void ebr_foo_reclaim(struct rcu_head *head)
+{
+	struct ebr_foo *fp = container_of(head, struct ebr_foo, rcu);
+
+	bench_gp_record(ktime_get_ns() - fp->retired_ns);
+	kfree(fp);
+}
+
+static int ebr_bench_init(void)
+{
+	int err;
+
+	err = toy_ebr_init();
+	if (err)
+		return err;
+
+	ebr_foo = bench_kmalloc(sizeof(struct ebr_foo));
+	if (!ebr_foo)
+		return -ENOMEM;
+
+	memset(ebr_foo, 0, sizeof(*ebr_foo));
+
+	return 0;
+}
+
+static void ebr_bench_exit(void)
+{
+	kfree(ebr_foo);
+	toy_ebr_exit();
+}
+
+static int ebr_bench_read(void)
+{
+	int retval;
+
+	toy_ebr_read_lock();
+	retval = READ_ONCE(ebr_foo)->foo.a;
+	toy_ebr_read_unlock();
+
+	return retval;
+}
+
+static void ebr_bench_update(int new_a)
+{
+	struct ebr_foo *new_fp;
+	struct ebr_foo *old_fp;
+
+	new_fp = bench_kmalloc(sizeof(struct ebr_foo));
+	if (!new_fp)
+		return;
+
+	spin_lock(&foo_mutex);
+	old_fp = ebr_foo;
+	new_fp->foo = old_fp->foo;
+	new_fp->foo.a = new_a;
+	smp_store_release(&ebr_foo, new_fp);
+	spin_unlock(&foo_mutex);
+
+	old_fp->retired_ns = ktime_get_ns();
+	toy_ebr_retire(&old_fp->rcu, ebr_foo_reclaim);
+}
+
+static struct bench_ops ebr_ops = {
+	.name	= "ebr",
+	.init	= ebr_bench_init,
+	.exit	= ebr_bench_exit,
+	.read	= ebr_bench_read,
+	.update	= ebr_bench_update,
+};
+
+static struct bench_ops *all_ops[] = {
+	&toy_ops,
+	&toy_exp_ops,
+	&rcu_ops,
+	&rwlock_ops,
+	&seqlock_ops,
+	&seqcount_ops,
+	&hp_ops,
+	&ebr_ops,
+};
+
+/*
+ * Once the duration is over, wait for kthread_stop() from the
+ * module exit path without consuming CPU time.
+ */
+static void bench_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int bench_thread_fn(void *arg)
+{
+	struct bench_thread *bt = arg;
+	unsigned long end = jiffies + duration * HZ;
+	u64 start = ktime_get_ns();
+	u64 ops = 0;
+	int sink = 0;
+	u64 t;
+	int err;
+
+	if (!bt->writer && cur_ops->reader_init) {
+		err = cur_ops->reader_init();
+		if (err) {
+			pr_err("reader_init: %d\n", err);
+			bt->err = err;
+			smp_store_release(&bt->done, true);
+			bench_park();
+			return err;
+		}
+	}
+
+	while (time_before(jiffies, end) && !kthread_should_stop()) {
+		if (bt->writer) {
+			t = ktime_get_ns();
+			cur_ops->update(ops & 0xff);
+			bench_hist_record(&update_hist, ktime_get_ns() - t);
+		} else if (ops & 0x3ff) {
+			sink += cur_ops->read();
+		} else {
+			t = ktime_get_ns();
+			sink += cur_ops->read();
+			bench_hist_record(&read_hist, ktime_get_ns() - t);
+		}
+		/* Readers may be pinned to every CPU. */
+		if (bt->writer || !(ops & 0x3ff))
+			cond_resched();
+		ops++;
+	}
+
+	bt->ops = ops;
+	bt->elapsed_ns = ktime_get_ns() - start;
+	/* Keep the reads from being optimized out. */
+	bt->sink = sink;
+	smp_store_release(&bt->done, true);
+
+	if (!bt->writer && cur_ops->reader_exit)
+		cur_ops->reader_exit();
+
+	bench_park();
+	return 0;
+}
+
+static int bench_cpu(int i)
+{
+	int n = i % num_online_cpus();
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		if (n-- == 0)
+			return cpu;
+
+	return cpumask_first(cpu_online_mask);
+}
+
+static u64 bench_rate(bool writer, int *running)
+{
+	u64 rate = 0;
+	u64 us;
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		struct bench_thread *bt = &threads[i];
+
+		if (bt->writer != writer)
+			continue;
+		if (!smp_load_acquire(&bt->done)) {
+			(*running)++;
+			continue;
+		}
+		if (bt->err)
+			continue;
+		us = div_u64(bt->elapsed_ns, NSEC_PER_USEC) ?: 1;
+		rate += div64_u64(bt->ops * USEC_PER_SEC, us);
+	}
+
+	return rate;
+}
+
+static u64 bench_alloc_rate(void)
+{
+	unsigned long allocs = 0;
+	u64 ns = 0;
+	u64 us;
+	int cpu;
+	int i;
+
+	for_each_possible_cpu(cpu)
+		allocs += per_cpu(bench_allocs, cpu);
+
+	for (i = 0; i < nthreads; i++)
+		ns = max(ns, threads[i].elapsed_ns);
+	us = div_u64(ns, NSEC_PER_USEC) ?: 1;
+
+	return div64_u64((u64)allocs * USEC_PER_SEC, us);
+}
+
+static int bench_results_show(struct seq_file *m, void *v)
+{
+	int running = 0;
+	int failed = 0;
+	u64 reads;
+	u64 updates;
+	int i;
+
+	reads = bench_rate(false, &running);
+	updates = bench_rate(true, &running);
+	for (i = 0; i < nthreads; i++)
+		if (smp_load_acquire(&threads[i].done) && threads[i].err)
+			failed++;
+
+	seq_printf(m, "mode: %s\n", cur_ops->name);
+	seq_printf(m, "readers: %d writers: %d pin: %d duration: %ds\n",
+		   nreaders, nwriters, pin, duration);
+	if (running) {
+		seq_printf(m, "state: running (%d threads)\n", running);
+		return 0;
+	}
+	seq_puts(m, "state: done\n");
+	if (failed)
+		seq_printf(m, "failed: %d threads\n", failed);
+	seq_printf(m, "reads/sec: %llu\n", reads);
+	seq_printf(m, "updates/sec: %llu\n", updates);
+	seq_printf(m, "allocs/sec: %llu\n", bench_alloc_rate());
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_results);
+
+static void bench_hist_show(struct seq_file *m, struct bench_hist *h,
+			    const char *what)
+{
+	long count;
+	int i;
+
+	seq_printf(m, "# %s latency [ns]: count\n", what);
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		count = atomic_long_read(&h->count[i]);
+		if (!count)
+			continue;
+		seq_printf(m, "[%llu, %llu): %ld\n",
+			   i ? 1ULL << (i - 1) : 0, 1ULL << i, count);
+	}
+}
+
+static int bench_gp_latency_show(struct seq_file *m, void *v)
+{
+	bench_hist_show(m, &gp_hist, "grace-period");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_gp_latency);
+
+static int bench_read_latency_show(struct seq_file *m, void *v)
+{
+	bench_hist_show(m, &read_hist, "read");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_read_latency);
+
+static int bench_alloc_latency_show(struct seq_file *m, void *v)
+{
+	bench_hist_show(m, &alloc_hist, "allocation");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_alloc_latency);
+
+static int bench_update_latency_show(struct seq_file *m, void *v)
+{
+	bench_hist_show(m, &update_hist, "update");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bench_update_latency);
+
+static void stop_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		if (threads[i].task)
+			kthread_stop(threads[i].task);
+}
+
+static int start_threads(void)
+{
+	struct bench_thread *bt;
+	int err;
+	int i;
+
+	nthreads = nreaders + nwriters;
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nthreads; i++) {
+		bt = &threads[i];
+		bt->writer = i >= nreaders;
+		bt->task = kthread_create(bench_thread_fn, bt, "bench %s %d",
+					  bt->writer ? "writer" : "reader", i);
+		if (IS_ERR(bt->task)) {
+			err = PTR_ERR(bt->task);
+			bt->task = NULL;
+			stop_threads();
+			kfree(threads);
+			return err;
+		}
+		if (pin)
+			kthread_bind(bt->task, bench_cpu(i));
+	}
+
+	for (i = 0; i < nthreads; i++)
+		wake_up_process(threads[i].task);
+
+	return 0;
+}
+
+static int __init init_sample_bench(void)
+{
+	int err;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(all_ops); i++)
+		if (!strcmp(mode, all_ops[i]->name))
+			cur_ops = all_ops[i];
+	if (!cur_ops) {
+		pr_err("unknown mode: %s\n", mode);
+		return -EINVAL;
+	}
+
+	if (nreaders < 0 || nwriters < 0 || duration <= 0)
+		return -EINVAL;
+
+	if (slab) {
+		err = foo_cache_init("bench_foo", sizeof(struct foo));
+		if (err)
+			return err;
+	}
+
+	if (cur_ops->init) {
+		err = cur_ops->init();
+		if (err)
+			goto out_slab;
+	}
+
+	err = start_threads();
+	if (err)
+		goto out;
+
+	/* Only once threads[] is fully set up. */
+	bench_dir = debugfs_create_dir("toy_rcu_bench", NULL);
+	debugfs_create_file("results", 0444, bench_dir, NULL,
+			    &bench_results_fops);
+	debugfs_create_file("gp_latency", 0444, bench_dir, NULL,
+			    &bench_gp_latency_fops);
+	debugfs_create_file("read_latency", 0444, bench_dir, NULL,
+			    &bench_read_latency_fops);
+	debugfs_create_file("alloc_latency", 0444, bench_dir, NULL,
+			    &bench_alloc_latency_fops);
+	debugfs_create_file("update_latency", 0444, bench_dir, NULL,
+			    &bench_update_latency_fops);
+
+	pr_info("--- RCU bench start: %s ---\n", cur_ops->name);
+
+	return 0;
+
+out:
+	if (cur_ops->exit)
+		cur_ops->exit();
+out_slab:
+	if (slab)
+		foo_cache_exit();
+	return err;
+}
+
+static void __exit exit_sample_bench(void)
+{
+	/* No reader of the debugfs files may see threads[] freed. */
+	debugfs_remove_recursive(bench_dir);
+	stop_threads();
+	kfree(threads);
+
+	if (cur_ops->exit)
+		cur_ops->exit();
+	if (slab)
+		foo_cache_exit();
+
+	pr_info("--- RCU bench stop ---\n");
+}
+
+MODULE_AUTHOR("Fumiya Shigemitsu");
+MODULE_DESCRIPTION("sample: RCU read/update benchmark");
+MODULE_LICENSE("GPL");
+
+module_init(init_sample_bench)
+module_exit(exit_sample_bench)
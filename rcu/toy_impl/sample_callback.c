@@ -0,0 +1,187 @@
+/* TOY RCU: asynchronous callbacks
+ *
+ * toy_call_rcu() never blocks: it appends the callback to a
+ * list owned by the current CPU and returns.  A single
+ * reclaimer kthread collects the lists of all CPUs, waits for
+ * one grace period with toy_synchronize_rcu() and then invokes
+ * every callback of the batch.  Callbacks queued while the
+ * reclaimer is waiting form the next batch, so the cost of a
+ * grace period is shared by all updates that arrived during
+ * the previous one.
+ *
+ * The reclaimer also drives the grace periods requested with
+ * toy_start_poll_synchronize_rcu(), so that polled cookies
+ * eventually complete even if no callback is queued.  It is only
+ * woken when the requested grace period is not covered yet.
+ *
+ * This works on top of any toy flavor, since it only needs
+ * toy_synchronize_rcu().
+ */
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/rcupdate.h>
+#include "toy_rcu.h"
+#include "toy_rcu_trace.h"
+
+struct toy_rcu_cblist {
+	spinlock_t lock;
+	struct rcu_head *head;
+	struct rcu_head **tail;
+};
+
+static DEFINE_PER_CPU(struct toy_rcu_cblist, toy_rcu_cblist);
+static atomic_long_t toy_rcu_cb_pending = ATOMIC_LONG_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(toy_rcu_reclaimer_wq);
+static struct task_struct *toy_rcu_reclaimer;
+/* Latest cookie handed out by toy_start_poll_synchronize_rcu(). */
+static unsigned long toy_rcu_gp_needed;
+static DEFINE_SPINLOCK(toy_rcu_gp_needed_lock);
+
+void toy_call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	struct toy_rcu_cblist *cbl;
+	unsigned long flags;
+
+	head->func = func;
+	head->next = NULL;
+
+	local_irq_save(flags);
+	cbl = this_cpu_ptr(&toy_rcu_cblist);
+	spin_lock(&cbl->lock);
+	*cbl->tail = head;
+	cbl->tail = &head->next;
+	spin_unlock(&cbl->lock);
+	local_irq_restore(flags);
+
+	/*
+	 * The reclaimer only sleeps when nothing is pending, so it
+	 * is enough to kick it for the first callback.
+	 */
+	if (atomic_long_inc_return(&toy_rcu_cb_pending) == 1)
+		wake_up(&toy_rcu_reclaimer_wq);
+}
+EXPORT_SYMBOL_GPL(toy_call_rcu);
+
+unsigned long toy_start_poll_synchronize_rcu(void)
+{
+	unsigned long cookie;
+	unsigned long flags;
+	bool wake = false;
+
+	cookie = toy_get_state_synchronize_rcu();
+
+	spin_lock_irqsave(&toy_rcu_gp_needed_lock, flags);
+	if (ULONG_CMP_LT(toy_rcu_gp_needed, cookie)) {
+		WRITE_ONCE(toy_rcu_gp_needed, cookie);
+		wake = true;
+	}
+	spin_unlock_irqrestore(&toy_rcu_gp_needed_lock, flags);
+
+	if (wake)
+		wake_up(&toy_rcu_reclaimer_wq);
+
+	return cookie;
+}
+EXPORT_SYMBOL_GPL(toy_start_poll_synchronize_rcu);
+
+static bool toy_rcu_gp_wanted(void)
+{
+	return !toy_poll_state_synchronize_rcu(READ_ONCE(toy_rcu_gp_needed));
+}
+
+static struct rcu_head *toy_rcu_collect(void)
+{
+	struct rcu_head *list = NULL;
+	struct rcu_head **tail = &list;
+	struct toy_rcu_cblist *cbl;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cbl = per_cpu_ptr(&toy_rcu_cblist, cpu);
+
+		spin_lock_irqsave(&cbl->lock, flags);
+		if (cbl->head) {
+			*tail = cbl->head;
+			tail = cbl->tail;
+			cbl->head = NULL;
+			cbl->tail = &cbl->head;
+		}
+		spin_unlock_irqrestore(&cbl->lock, flags);
+	}
+
+	return list;
+}
+
+static void toy_rcu_do_batch(void)
+{
+	struct rcu_head *list;
+	struct rcu_head *next;
+	long n = 0;
+
+	list = toy_rcu_collect();
+	if (!list)
+		return;
+
+	toy_synchronize_rcu();
+
+	for (; list; list = next) {
+		next = list->next;
+		trace_toy_rcu_invoke_callback(list);
+		list->func(list);
+		n++;
+	}
+	atomic_long_sub(n, &toy_rcu_cb_pending);
+}
+
+static int toy_rcu_reclaimer_fn(void *arg)
+{
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(toy_rcu_reclaimer_wq,
+					 atomic_long_read(&toy_rcu_cb_pending) ||
+					 toy_rcu_gp_wanted() ||
+					 kthread_should_stop());
+		toy_rcu_do_batch();
+		if (toy_rcu_gp_wanted())
+			toy_synchronize_rcu();
+	}
+
+	/* Nobody queues callbacks anymore: flush what is left. */
+	while (atomic_long_read(&toy_rcu_cb_pending))
+		toy_rcu_do_batch();
+
+	return 0;
+}
+
+int toy_rcu_init(void)
+{
+	struct toy_rcu_cblist *cbl;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cbl = per_cpu_ptr(&toy_rcu_cblist, cpu);
+		spin_lock_init(&cbl->lock);
+		cbl->head = NULL;
+		cbl->tail = &cbl->head;
+	}
+
+	toy_rcu_reclaimer = kthread_run(toy_rcu_reclaimer_fn, NULL,
+					"toy_rcu_reclaimer");
+	if (IS_ERR(toy_rcu_reclaimer))
+		return PTR_ERR(toy_rcu_reclaimer);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(toy_rcu_init);
+
+/*
+ * Must be called after the last toy_call_rcu(): it waits for
+ * all queued callbacks to be invoked.
+ */
+void toy_rcu_exit(void)
+{
+	kthread_stop(toy_rcu_reclaimer);
+}
+EXPORT_SYMBOL_GPL(toy_rcu_exit);
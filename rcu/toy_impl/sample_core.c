@@ -0,0 +1,28 @@
+/* TOY RCU core module
+ *
+ * The flavor chosen with FLAVOR=, grace-period sharing and
+ * toy_call_rcu() are built once into toy_rcu.ko, which sample.ko
+ * and bench.ko both use.  The toy_rcu tracepoints are therefore
+ * instantiated only once, by sample_gp.c, whichever of the
+ * samples is loaded.
+ */
+#include <linux/module.h>
+#include "toy_rcu_flavor.h"
+
+static int __init init_toy_rcu_core(void)
+{
+	return __toy_rcu_flavor_init();
+}
+
+/* The samples using toy_rcu.ko, and so every updater, are gone. */
+static void __exit exit_toy_rcu_core(void)
+{
+	__toy_rcu_flavor_exit();
+}
+
+MODULE_AUTHOR("Fumiya Shigemitsu");
+MODULE_DESCRIPTION("TOY RCU core");
+MODULE_LICENSE("GPL");
+
+module_init(init_toy_rcu_core)
+module_exit(exit_toy_rcu_core)
@@ -0,0 +1,170 @@
+/* TOY epoch-based reclamation
+ *
+ * Three epochs are enough: while the global epoch is e, active
+ * readers announced either e or e - 1.  The epoch only advances
+ * from e to e + 1 once every active reader announced e, so at
+ * that point no reader that could have seen an object retired
+ * in epoch e - 1 is left, and the limbo list of epoch e - 1 is
+ * freed.  The list that gets reused for epoch e + 1 is the same
+ * one, (e + 1) % 3 == (e - 2) % 3.
+ *
+ * Unlike a toy grace period, advancing never waits: it scans the
+ * per-CPU announcements once and gives up if a CPU is still in an
+ * older epoch.  Updaters try it whenever their CPU has retired a
+ * batch of objects, so reclamation latency is a couple of epoch
+ * advances instead of a full grace period.
+ *
+ * Readers run with preemption disabled and must not be used from
+ * interrupt context, since the nesting count is plain per-CPU data.
+ */
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include "toy_ebr.h"
+
+#define TOY_EBR_BATCH 16
+
+struct toy_ebr_limbo {
+	spinlock_t lock;
+	struct rcu_head *head[3];
+	long count;
+};
+
+DEFINE_PER_CPU(struct toy_ebr_reader, toy_ebr_reader);
+unsigned long toy_ebr_epoch;
+static DEFINE_PER_CPU(struct toy_ebr_limbo, toy_ebr_limbo);
+static DEFINE_SPINLOCK(toy_ebr_advance_lock);
+
+static void toy_ebr_free(struct rcu_head *list)
+{
+	struct rcu_head *next;
+
+	for (; list; list = next) {
+		next = list->next;
+		list->func(list);
+	}
+}
+
+static bool toy_ebr_can_advance(unsigned long epoch)
+{
+	unsigned long state;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		state = READ_ONCE(per_cpu_ptr(&toy_ebr_reader, cpu)->state);
+		if ((state & 0x1) && (state >> 1) != epoch)
+			return false;
+	}
+
+	return true;
+}
+
+static void __toy_ebr_advance(void)
+{
+	struct toy_ebr_limbo *lp;
+	struct rcu_head *list;
+	unsigned long epoch;
+	unsigned long flags;
+	int idx;
+	int cpu;
+
+	epoch = toy_ebr_epoch + 1;
+	WRITE_ONCE(toy_ebr_epoch, epoch);
+	/* Order the new epoch before freeing the old objects. */
+	smp_mb();
+
+	idx = (epoch + 1) % 3;
+	for_each_possible_cpu(cpu) {
+		lp = per_cpu_ptr(&toy_ebr_limbo, cpu);
+
+		spin_lock_irqsave(&lp->lock, flags);
+		list = lp->head[idx];
+		lp->head[idx] = NULL;
+		lp->count = 0;
+		spin_unlock_irqrestore(&lp->lock, flags);
+
+		toy_ebr_free(list);
+	}
+}
+
+/*
+ * Advance the global epoch if every active reader caught up with
+ * it, and free the objects that became safe.  Never waits.
+ */
+bool toy_ebr_try_advance(void)
+{
+	bool advanced = false;
+
+	if (!spin_trylock(&toy_ebr_advance_lock))
+		return false;
+
+	/* Order the caller's unpublishing before the scan. */
+	smp_mb();
+	if (toy_ebr_can_advance(toy_ebr_epoch)) {
+		__toy_ebr_advance();
+		advanced = true;
+	}
+	spin_unlock(&toy_ebr_advance_lock);
+
+	return advanced;
+}
+
+void toy_ebr_retire(struct rcu_head *head, rcu_callback_t func)
+{
+	struct toy_ebr_limbo *lp;
+	unsigned long flags;
+	bool advance;
+	int idx;
+
+	head->func = func;
+
+	/*
+	 * Order the unpublishing before reading the epoch, so the
+	 * object is filed under an epoch no older than the one it
+	 * was reachable in.
+	 */
+	smp_mb();
+
+	local_irq_save(flags);
+	lp = this_cpu_ptr(&toy_ebr_limbo);
+	spin_lock(&lp->lock);
+	idx = READ_ONCE(toy_ebr_epoch) % 3;
+	head->next = lp->head[idx];
+	lp->head[idx] = head;
+	advance = ++lp->count >= TOY_EBR_BATCH;
+	spin_unlock(&lp->lock);
+	local_irq_restore(flags);
+
+	if (advance)
+		toy_ebr_try_advance();
+}
+
+int toy_ebr_init(void)
+{
+	struct toy_ebr_limbo *lp;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		lp = per_cpu_ptr(&toy_ebr_limbo, cpu);
+		spin_lock_init(&lp->lock);
+		memset(lp->head, 0, sizeof(lp->head));
+		lp->count = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Must be called once no reader is left: three advances go
+ * through all limbo lists.
+ */
+void toy_ebr_exit(void)
+{
+	int i;
+
+	spin_lock(&toy_ebr_advance_lock);
+	for (i = 0; i < 3; i++)
+		__toy_ebr_advance();
+	spin_unlock(&toy_ebr_advance_lock);
+}
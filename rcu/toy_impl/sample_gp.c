@@ -0,0 +1,111 @@
+/* TOY RCU: grace-period sharing
+ *
+ * toy_rcu_gp_seq counts grace periods: its low bit is set while
+ * one is in progress, and the rest is the number of completed
+ * ones.  A caller of toy_synchronize_rcu() only needs a grace
+ * period that starts after its call, so it records the value
+ * toy_rcu_gp_seq will have once such a grace period has ended.
+ * If another caller completed that grace period while this one
+ * was waiting for the mutex, there is nothing left to do.
+ *
+ * N updaters that arrive while a grace period is in flight all
+ * wait for the next one, which only one of them drives, so they
+ * complete in about two grace periods instead of N.
+ *
+ * The same snapshot is handed out as a cookie by
+ * toy_get_state_synchronize_rcu(), so that an updater can check
+ * later with toy_poll_state_synchronize_rcu() whether it may
+ * free an old object, instead of blocking right away.
+ *
+ * Expedited grace periods are not shared and leave toy_rcu_gp_seq
+ * alone; they have their own counter, only for the tracepoints.
+ */
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+
+#define CREATE_TRACE_POINTS
+#include "toy_rcu_trace.h"
+
+static unsigned long toy_rcu_gp_seq;
+static DEFINE_MUTEX(toy_rcu_gp_seq_mutex);
+static atomic_long_t toy_rcu_exp_seq;
+
+/* The value of toy_rcu_gp_seq once a full grace period has passed. */
+static unsigned long toy_rcu_seq_snap(void)
+{
+	/* Order the snapshot after the caller's prior updates. */
+	smp_mb();
+
+	return (READ_ONCE(toy_rcu_gp_seq) + 3) & ~0x1UL;
+}
+
+static bool toy_rcu_seq_done(unsigned long s)
+{
+	return ULONG_CMP_GE(READ_ONCE(toy_rcu_gp_seq), s);
+}
+
+void toy_synchronize_rcu(void)
+{
+	unsigned long s;
+	u64 t;
+
+	s = toy_rcu_seq_snap();
+
+	/* A QSBR caller may have to wait for another updater. */
+	toy_rcu_thread_offline();
+	mutex_lock(&toy_rcu_gp_seq_mutex);
+	if (!toy_rcu_seq_done(s)) {
+		WRITE_ONCE(toy_rcu_gp_seq, toy_rcu_gp_seq + 1);
+		trace_toy_rcu_gp_start(toy_rcu_gp_seq, false);
+		t = ktime_get_ns();
+		__toy_synchronize_rcu();
+		trace_toy_rcu_gp_end(toy_rcu_gp_seq, ktime_get_ns() - t, false);
+		WRITE_ONCE(toy_rcu_gp_seq, toy_rcu_gp_seq + 1);
+	}
+	mutex_unlock(&toy_rcu_gp_seq_mutex);
+	toy_rcu_thread_online();
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
+EXPORT_SYMBOL_GPL(toy_synchronize_rcu);
+
+void toy_synchronize_rcu_expedited(void)
+{
+	unsigned long s = atomic_long_inc_return(&toy_rcu_exp_seq);
+	u64 t;
+
+	trace_toy_rcu_gp_start(s, true);
+	t = ktime_get_ns();
+	toy_rcu_thread_offline();
+	__toy_synchronize_rcu_expedited();
+	toy_rcu_thread_online();
+	trace_toy_rcu_gp_end(s, ktime_get_ns() - t, true);
+}
+EXPORT_SYMBOL_GPL(toy_synchronize_rcu_expedited);
+
+/*
+ * Nothing is started: someone else has to call
+ * toy_synchronize_rcu(), see toy_start_poll_synchronize_rcu().
+ */
+unsigned long toy_get_state_synchronize_rcu(void)
+{
+	return toy_rcu_seq_snap();
+}
+EXPORT_SYMBOL_GPL(toy_get_state_synchronize_rcu);
+
+bool toy_poll_state_synchronize_rcu(unsigned long cookie)
+{
+	if (!toy_rcu_seq_done(cookie))
+		return false;
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(toy_poll_state_synchronize_rcu);
@@ -0,0 +1,225 @@
+/* TOY hazard pointers
+ *
+ * Every CPU owns TOY_HP_SLOTS hazard slots.  A reader publishes
+ * the pointer it is about to dereference in one of them and
+ * re-reads the source: if it did not change, an updater that
+ * replaces it afterwards is guaranteed to see the hazard.  The
+ * reader keeps preemption disabled while it holds the slot, so
+ * nobody else on that CPU can reuse it.  Slots must not be used
+ * from interrupt context.
+ *
+ * toy_hp_retire() puts the old object on a list of the current
+ * CPU and returns.  Once a CPU has TOY_HP_BATCH retired objects,
+ * the updater scans: it takes all retired objects, snapshots the
+ * hazard slots of every CPU into a sorted array and frees each
+ * object that is not found there.  The cost of reading all slots
+ * is shared by a whole batch, and at most one object per slot
+ * survives a scan, which bounds the memory held by retired
+ * objects no matter how long a reader holds on to its pointer.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+#include "toy_hp.h"
+
+#define TOY_HP_BATCH 64
+
+struct toy_hp_slots {
+	void *ptr[TOY_HP_SLOTS];
+};
+
+struct toy_hp_rlist {
+	spinlock_t lock;
+	struct toy_hp_head *head;
+	long count;
+};
+
+static DEFINE_PER_CPU(struct toy_hp_slots, toy_hp_slots);
+static DEFINE_PER_CPU(struct toy_hp_rlist, toy_hp_rlist);
+static DEFINE_MUTEX(toy_hp_scan_mutex);
+/* Snapshot of all hazard slots, protected by toy_hp_scan_mutex. */
+static void **toy_hp_snap;
+
+void *__toy_hp_protect(int slot, void **pp)
+{
+	void **hp;
+	void *p;
+	void *q;
+
+	preempt_disable();
+	hp = &this_cpu_ptr(&toy_hp_slots)->ptr[slot];
+	p = READ_ONCE(*pp);
+	do {
+		WRITE_ONCE(*hp, p);
+		/* Order the hazard before re-reading the source. */
+		smp_mb();
+		q = p;
+		p = READ_ONCE(*pp);
+	} while (p != q);
+
+	return p;
+}
+
+void toy_hp_clear(int slot)
+{
+	/* Order the reader's accesses before releasing the slot. */
+	smp_store_release(&this_cpu_ptr(&toy_hp_slots)->ptr[slot], NULL);
+	preempt_enable();
+}
+
+static int toy_hp_cmp(const void *a, const void *b)
+{
+	unsigned long x = (unsigned long)*(void * const *)a;
+	unsigned long y = (unsigned long)*(void * const *)b;
+
+	if (x < y)
+		return -1;
+	return x > y;
+}
+
+static struct toy_hp_head *toy_hp_collect(void)
+{
+	struct toy_hp_head *list = NULL;
+	struct toy_hp_head *head;
+	struct toy_hp_rlist *rl;
+	unsigned long flags;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rl = per_cpu_ptr(&toy_hp_rlist, cpu);
+
+		spin_lock_irqsave(&rl->lock, flags);
+		while ((head = rl->head)) {
+			rl->head = head->next;
+			head->next = list;
+			list = head;
+		}
+		rl->count = 0;
+		spin_unlock_irqrestore(&rl->lock, flags);
+	}
+
+	return list;
+}
+
+static void toy_hp_requeue(struct toy_hp_head *list)
+{
+	struct toy_hp_rlist *rl;
+	struct toy_hp_head *next;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	rl = this_cpu_ptr(&toy_hp_rlist);
+	spin_lock(&rl->lock);
+	for (; list; list = next) {
+		next = list->next;
+		list->next = rl->head;
+		rl->head = list;
+		rl->count++;
+	}
+	spin_unlock(&rl->lock);
+	local_irq_restore(flags);
+}
+
+/* May sleep. */
+void toy_hp_scan(void)
+{
+	struct toy_hp_head *kept = NULL;
+	struct toy_hp_head *list;
+	struct toy_hp_head *next;
+	void *p;
+	int n = 0;
+	int cpu;
+	int i;
+
+	mutex_lock(&toy_hp_scan_mutex);
+
+	/*
+	 * Take the retired objects before reading the slots: an
+	 * object retired after the snapshot may be protected by a
+	 * hazard the snapshot missed.
+	 */
+	list = toy_hp_collect();
+	/* Order the unpublishing of the objects before the snapshot. */
+	smp_mb();
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < TOY_HP_SLOTS; i++) {
+			p = READ_ONCE(per_cpu_ptr(&toy_hp_slots, cpu)->ptr[i]);
+			if (p)
+				toy_hp_snap[n++] = p;
+		}
+	}
+	sort(toy_hp_snap, n, sizeof(void *), toy_hp_cmp, NULL);
+
+	for (; list; list = next) {
+		next = list->next;
+		if (bsearch(&list->ptr, toy_hp_snap, n, sizeof(void *),
+			    toy_hp_cmp)) {
+			list->next = kept;
+			kept = list;
+			continue;
+		}
+		list->func(list);
+	}
+
+	mutex_unlock(&toy_hp_scan_mutex);
+
+	toy_hp_requeue(kept);
+}
+
+/* May sleep when the retired objects of this CPU are scanned. */
+void toy_hp_retire(struct toy_hp_head *head, void *ptr,
+		   void (*func)(struct toy_hp_head *head))
+{
+	struct toy_hp_rlist *rl;
+	unsigned long flags;
+	bool scan;
+
+	head->ptr = ptr;
+	head->func = func;
+
+	local_irq_save(flags);
+	rl = this_cpu_ptr(&toy_hp_rlist);
+	spin_lock(&rl->lock);
+	head->next = rl->head;
+	rl->head = head;
+	scan = ++rl->count >= TOY_HP_BATCH;
+	spin_unlock(&rl->lock);
+	local_irq_restore(flags);
+
+	if (scan)
+		toy_hp_scan();
+}
+
+int toy_hp_init(void)
+{
+	struct toy_hp_rlist *rl;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		rl = per_cpu_ptr(&toy_hp_rlist, cpu);
+		spin_lock_init(&rl->lock);
+		rl->head = NULL;
+		rl->count = 0;
+	}
+
+	toy_hp_snap = kmalloc_array(num_possible_cpus() * TOY_HP_SLOTS,
+				    sizeof(void *), GFP_KERNEL);
+	if (!toy_hp_snap)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Must be called once no reader holds a slot anymore: every
+ * retired object is freed.
+ */
+void toy_hp_exit(void)
+{
+	toy_hp_scan();
+	kfree(toy_hp_snap);
+}
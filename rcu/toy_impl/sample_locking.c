@@ -14,20 +14,27 @@
  * call, you can deadlock.
  */
 #include <linux/module.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+#include "toy_rcu_trace.h"
 
 static DEFINE_RWLOCK(rcu_gp_mutex);
 
 void toy_rcu_read_lock(void)
 {
 	read_lock(&rcu_gp_mutex);
+	trace_toy_rcu_read_lock(_RET_IP_);
 }
+EXPORT_SYMBOL_GPL(toy_rcu_read_lock);
 
 void toy_rcu_read_unlock(void)
 {
+	trace_toy_rcu_read_unlock(_RET_IP_);
 	read_unlock(&rcu_gp_mutex);
 }
+EXPORT_SYMBOL_GPL(toy_rcu_read_unlock);
 
-void toy_synchronize_rcu(void)
+void __toy_synchronize_rcu(void)
 {
 	write_lock(&rcu_gp_mutex);
 	/* smp_mb__after_spinlock():
@@ -45,6 +52,15 @@ void toy_synchronize_rcu(void)
 	write_unlock(&rcu_gp_mutex);
 }
 
+/*
+ * write_lock() already returns as soon as the last reader
+ * leaves, there is no passive waiting to cut short here.
+ */
+void __toy_synchronize_rcu_expedited(void)
+{
+	__toy_synchronize_rcu();
+}
+
 /* QUIZ 1
  * How could a deadlock occur when using this algorithm in
  * a real world Linux kernel?
@@ -0,0 +1,177 @@
+/* TOY RCU implementation: per-CPU reference counters
+ *
+ * Each CPU owns a pair of reader counters, so a read-side
+ * critical section only touches a cache line that is local
+ * to the CPU it runs on, instead of bouncing rcu_gp_mutex
+ * between all readers as sample_locking.c does.
+ *
+ * Read-side critical sections run with preemption disabled,
+ * so lock and unlock always hit the same CPU's counters and
+ * the nesting depth can be kept per CPU as well.
+ *
+ * A grace period uses a two-phase counter flip:
+ * it switches new readers over to the other counter of
+ * each pair and waits for the old counters to drain on all
+ * CPUs.  A reader may have fetched the index just before the
+ * flip and only incremented the old counter after the updater
+ * saw it drained, so the flip is done twice: after the second
+ * drain, every reader that started before the grace period
+ * is guaranteed to have finished.
+ *
+ * toy_synchronize_rcu_expedited() does not flip anything: it
+ * sends an IPI to every online CPU.  A CPU that is not inside
+ * a read-side critical section when the IPI arrives is already
+ * quiescent, since any later reader there sees the new data.
+ * For the others, the updater spins until the CPU leaves its
+ * current outermost critical section.  This trades an
+ * interrupt on every CPU for not sleeping on the counters.
+ */
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/smp.h>
+#include <linux/cpu.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+#include "toy_rcu_trace.h"
+
+struct toy_rcu_data {
+	unsigned long refcnt[2];
+	int nesting;
+	int idx;
+	/* Number of outermost unlocks, for expedited grace periods. */
+	unsigned long qs_seq;
+	unsigned long exp_seq;
+	bool exp_need;
+};
+
+static DEFINE_PER_CPU(struct toy_rcu_data, toy_rcu_data);
+static unsigned long toy_rcu_idx;
+static DEFINE_MUTEX(toy_rcu_gp_mutex);
+static DEFINE_MUTEX(toy_rcu_exp_mutex);
+
+void toy_rcu_read_lock(void)
+{
+	struct toy_rcu_data *rdp;
+	unsigned long flags;
+	int idx;
+
+	preempt_disable();
+	/*
+	 * An interrupt between the counter update and the nesting
+	 * update would see an inconsistent pair, so keep the
+	 * bookkeeping irq-safe.
+	 */
+	local_irq_save(flags);
+	rdp = this_cpu_ptr(&toy_rcu_data);
+	if (rdp->nesting++ == 0) {
+		idx = READ_ONCE(toy_rcu_idx) & 0x1;
+		rdp->idx = idx;
+		WRITE_ONCE(rdp->refcnt[idx], rdp->refcnt[idx] + 1);
+	}
+	local_irq_restore(flags);
+	/* Order the counter increment before the critical section. */
+	smp_mb();
+	trace_toy_rcu_read_lock(_RET_IP_);
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_lock);
+
+void toy_rcu_read_unlock(void)
+{
+	struct toy_rcu_data *rdp;
+	unsigned long flags;
+
+	trace_toy_rcu_read_unlock(_RET_IP_);
+	/* Order the critical section before the counter decrement. */
+	smp_mb();
+	local_irq_save(flags);
+	rdp = this_cpu_ptr(&toy_rcu_data);
+	if (--rdp->nesting == 0) {
+		WRITE_ONCE(rdp->refcnt[rdp->idx], rdp->refcnt[rdp->idx] - 1);
+		WRITE_ONCE(rdp->qs_seq, rdp->qs_seq + 1);
+	}
+	local_irq_restore(flags);
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_unlock);
+
+static unsigned long toy_rcu_readers(int idx)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(&toy_rcu_data, cpu)->refcnt[idx]);
+
+	return sum;
+}
+
+static void toy_rcu_flip_and_wait(void)
+{
+	int idx = toy_rcu_idx & 0x1;
+
+	WRITE_ONCE(toy_rcu_idx, toy_rcu_idx + 1);
+	/* Order the flip before checking the old counters. */
+	smp_mb();
+
+	while (toy_rcu_readers(idx))
+		schedule_timeout_uninterruptible(1);
+
+	/* Order the drained counters before the next phase. */
+	smp_mb();
+}
+
+void __toy_synchronize_rcu(void)
+{
+	/* Order the caller's prior updates before the flip. */
+	smp_mb();
+
+	mutex_lock(&toy_rcu_gp_mutex);
+	toy_rcu_flip_and_wait();
+	toy_rcu_flip_and_wait();
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
+
+/*
+ * Runs with interrupts disabled, and the read-side bookkeeping
+ * is done with interrupts disabled too, so nesting is stable.
+ */
+static void toy_rcu_exp_handler(void *unused)
+{
+	struct toy_rcu_data *rdp = this_cpu_ptr(&toy_rcu_data);
+
+	rdp->exp_need = rdp->nesting != 0;
+	rdp->exp_seq = rdp->qs_seq;
+	smp_mb();
+}
+
+void __toy_synchronize_rcu_expedited(void)
+{
+	struct toy_rcu_data *rdp;
+	int cpu;
+
+	/* Order the caller's prior updates before the IPIs. */
+	smp_mb();
+
+	mutex_lock(&toy_rcu_exp_mutex);
+	/* The CPUs that got the IPI are the ones scanned below. */
+	cpus_read_lock();
+	on_each_cpu(toy_rcu_exp_handler, NULL, 1);
+
+	for_each_online_cpu(cpu) {
+		rdp = per_cpu_ptr(&toy_rcu_data, cpu);
+		if (!rdp->exp_need)
+			continue;
+		while (READ_ONCE(rdp->qs_seq) == rdp->exp_seq)
+			cpu_relax();
+	}
+	cpus_read_unlock();
+	mutex_unlock(&toy_rcu_exp_mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
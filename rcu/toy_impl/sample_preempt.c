@@ -0,0 +1,221 @@
+/* TOY RCU implementation: preemptible readers
+ *
+ * sample_locking.c makes a reader hold a rwlock, and the other
+ * flavors make it disable preemption, so a long read-side
+ * critical section delays every task that waits for its CPU.
+ * Here a reader may be preempted anywhere.
+ *
+ * A registered thread keeps its nesting depth in its own
+ * struct toy_rcu_task, found through a per-CPU pointer that a
+ * preempt notifier keeps up to date, as in sample_qsbr.c.  When
+ * the thread is switched out inside a critical section, the
+ * notifier queues it on the blocked-readers list, and its
+ * outermost toy_rcu_read_unlock() takes it off again.
+ *
+ * A grace period first runs a work item on every CPU: once it
+ * ran, each reader that was on that CPU has either finished or
+ * been switched out, i.e. queued as blocked.  It then waits
+ * until every thread that was blocked by then has left the list.
+ * Threads that block later carry a newer generation and are not
+ * waited for, so a steady stream of preempted readers cannot
+ * hold a grace period back forever.
+ *
+ * Threads that did not register fall back to disabling
+ * preemption for their critical sections, which the per-CPU work
+ * items cover as well.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/preempt.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+#include "toy_rcu_trace.h"
+
+struct toy_rcu_task {
+	int nesting;
+	bool blocked;
+	/* toy_rcu_gp_gen when it was queued as blocked. */
+	unsigned long blkd_gen;
+	struct list_head blkd;
+	struct preempt_notifier pn;
+};
+
+static DEFINE_PER_CPU(struct toy_rcu_task *, toy_rcu_cur_task);
+/* Oldest first, since generations only grow. */
+static LIST_HEAD(toy_rcu_blkd_tasks);
+static DEFINE_RAW_SPINLOCK(toy_rcu_blkd_lock);
+static unsigned long toy_rcu_gp_gen;
+static DECLARE_WAIT_QUEUE_HEAD(toy_rcu_gp_wq);
+static DEFINE_MUTEX(toy_rcu_gp_mutex);
+
+static void toy_rcu_sched_in(struct preempt_notifier *pn, int cpu)
+{
+	this_cpu_write(toy_rcu_cur_task,
+		       container_of(pn, struct toy_rcu_task, pn));
+}
+
+/* Called with the runqueue lock held and interrupts disabled. */
+static void toy_rcu_sched_out(struct preempt_notifier *pn,
+			      struct task_struct *next)
+{
+	struct toy_rcu_task *t = container_of(pn, struct toy_rcu_task, pn);
+
+	if (t->nesting && !t->blocked) {
+		raw_spin_lock(&toy_rcu_blkd_lock);
+		t->blocked = true;
+		t->blkd_gen = toy_rcu_gp_gen;
+		list_add_tail(&t->blkd, &toy_rcu_blkd_tasks);
+		raw_spin_unlock(&toy_rcu_blkd_lock);
+	}
+	this_cpu_write(toy_rcu_cur_task, NULL);
+}
+
+static struct preempt_ops toy_rcu_preempt_ops = {
+	.sched_in	= toy_rcu_sched_in,
+	.sched_out	= toy_rcu_sched_out,
+};
+
+void toy_rcu_read_lock(void)
+{
+	struct toy_rcu_task *t;
+
+	preempt_disable();
+	trace_toy_rcu_read_lock(_RET_IP_);
+	t = this_cpu_read(toy_rcu_cur_task);
+	if (!t)
+		/* Unregistered: stay non-preemptible until the unlock. */
+		return;
+	t->nesting++;
+	preempt_enable();
+	barrier();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_lock);
+
+static void toy_rcu_unblock(struct toy_rcu_task *t)
+{
+	unsigned long flags;
+
+	/* Order the critical section before leaving the list. */
+	smp_mb();
+	raw_spin_lock_irqsave(&toy_rcu_blkd_lock, flags);
+	list_del_init(&t->blkd);
+	t->blocked = false;
+	raw_spin_unlock_irqrestore(&toy_rcu_blkd_lock, flags);
+
+	wake_up(&toy_rcu_gp_wq);
+}
+
+void toy_rcu_read_unlock(void)
+{
+	struct toy_rcu_task *t;
+
+	trace_toy_rcu_read_unlock(_RET_IP_);
+	barrier();
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_task);
+	if (!t) {
+		preempt_enable();
+		/* Pairs with the preempt_disable() of toy_rcu_read_lock(). */
+		preempt_enable();
+		return;
+	}
+	/* Switching out from here on does not queue t anymore. */
+	if (--t->nesting == 0 && t->blocked)
+		toy_rcu_unblock(t);
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_unlock);
+
+int toy_rcu_register_thread(void)
+{
+	struct toy_rcu_task *t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&t->blkd);
+	preempt_notifier_init(&t->pn, &toy_rcu_preempt_ops);
+
+	preempt_notifier_inc();
+	preempt_disable();
+	preempt_notifier_register(&t->pn);
+	this_cpu_write(toy_rcu_cur_task, t);
+	preempt_enable();
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(toy_rcu_register_thread);
+
+/* Must be called outside of any read-side critical section. */
+void toy_rcu_unregister_thread(void)
+{
+	struct toy_rcu_task *t;
+
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_task);
+	WARN_ON_ONCE(t->nesting);
+	preempt_notifier_unregister(&t->pn);
+	this_cpu_write(toy_rcu_cur_task, NULL);
+	preempt_enable();
+	preempt_notifier_dec();
+
+	kfree(t);
+}
+EXPORT_SYMBOL_GPL(toy_rcu_unregister_thread);
+
+static void toy_rcu_qs_work_fn(struct work_struct *work)
+{
+}
+
+static bool toy_rcu_blkd_done(unsigned long gen)
+{
+	struct toy_rcu_task *t;
+	bool done;
+
+	raw_spin_lock_irq(&toy_rcu_blkd_lock);
+	t = list_first_entry_or_null(&toy_rcu_blkd_tasks, struct toy_rcu_task,
+				     blkd);
+	done = !t || t->blkd_gen == gen;
+	raw_spin_unlock_irq(&toy_rcu_blkd_lock);
+
+	return done;
+}
+
+void __toy_synchronize_rcu(void)
+{
+	unsigned long gen;
+
+	/* Order the caller's prior updates before the grace period. */
+	smp_mb();
+
+	mutex_lock(&toy_rcu_gp_mutex);
+
+	/* Every CPU switches at least once. */
+	schedule_on_each_cpu(toy_rcu_qs_work_fn);
+
+	raw_spin_lock_irq(&toy_rcu_blkd_lock);
+	gen = ++toy_rcu_gp_gen;
+	raw_spin_unlock_irq(&toy_rcu_blkd_lock);
+
+	wait_event(toy_rcu_gp_wq, toy_rcu_blkd_done(gen));
+
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
+
+/*
+ * The blocked readers have to run again before they can leave
+ * their critical sections, there is nothing to force here.
+ */
+void __toy_synchronize_rcu_expedited(void)
+{
+	__toy_synchronize_rcu();
+}
@@ -0,0 +1,210 @@
+/* TOY RCU implementation: quiescent-state-based reclamation
+ *
+ * toy_rcu_read_lock() and toy_rcu_read_unlock() compile to
+ * nothing (see toy_rcu.h).  Instead, every reader thread
+ * registers itself and periodically announces with
+ * toy_rcu_quiescent_state() that it holds no reference to
+ * RCU-protected data, e.g. between two iterations of its main
+ * loop.
+ *
+ * Each registered thread has a counter that is set to the
+ * global grace-period counter when it passes a quiescent
+ * state.  A grace period advances the global counter
+ * and waits until every thread either caught up with it or is
+ * offline (counter 0, i.e. unregistering, or blocked in
+ * toy_synchronize_rcu() itself, see toy_rcu_thread_offline()).
+ *
+ * A module cannot add a field to task_struct, so the thread
+ * state is found through a per-CPU pointer that a preempt
+ * notifier keeps pointing to the registered task running on
+ * that CPU.  This needs CONFIG_PREEMPT_NOTIFIERS.
+ *
+ * An IPI cannot force a quiescent state here: the thread that
+ * is interrupted, or any registered thread that is currently
+ * preempted, may be in the middle of a read-side critical
+ * section.  The expedited grace period therefore only polls
+ * the thread counters without sleeping.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/preempt.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+
+struct toy_rcu_thread {
+	unsigned long ctr;
+	struct list_head node;
+	struct preempt_notifier pn;
+};
+
+static DEFINE_PER_CPU(struct toy_rcu_thread *, toy_rcu_cur_thread);
+static LIST_HEAD(toy_rcu_threads);
+static unsigned long toy_rcu_gp_ctr = 1;
+static DEFINE_MUTEX(toy_rcu_gp_mutex);
+
+static void toy_rcu_sched_in(struct preempt_notifier *pn, int cpu)
+{
+	this_cpu_write(toy_rcu_cur_thread,
+		       container_of(pn, struct toy_rcu_thread, pn));
+}
+
+static void toy_rcu_sched_out(struct preempt_notifier *pn,
+			      struct task_struct *next)
+{
+	this_cpu_write(toy_rcu_cur_thread, NULL);
+}
+
+static struct preempt_ops toy_rcu_preempt_ops = {
+	.sched_in	= toy_rcu_sched_in,
+	.sched_out	= toy_rcu_sched_out,
+};
+
+void toy_rcu_quiescent_state(void)
+{
+	struct toy_rcu_thread *t;
+
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_thread);
+	if (t) {
+		/* Order prior read-side accesses before the report. */
+		smp_mb();
+		WRITE_ONCE(t->ctr, READ_ONCE(toy_rcu_gp_ctr));
+		/* Order the report before subsequent read-side accesses. */
+		smp_mb();
+	}
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_quiescent_state);
+
+int toy_rcu_register_thread(void)
+{
+	struct toy_rcu_thread *t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	preempt_notifier_init(&t->pn, &toy_rcu_preempt_ops);
+
+	mutex_lock(&toy_rcu_gp_mutex);
+	WRITE_ONCE(t->ctr, toy_rcu_gp_ctr);
+	list_add(&t->node, &toy_rcu_threads);
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	preempt_notifier_inc();
+	preempt_disable();
+	preempt_notifier_register(&t->pn);
+	this_cpu_write(toy_rcu_cur_thread, t);
+	preempt_enable();
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(toy_rcu_register_thread);
+
+void toy_rcu_unregister_thread(void)
+{
+	struct toy_rcu_thread *t;
+
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_thread);
+	preempt_notifier_unregister(&t->pn);
+	this_cpu_write(toy_rcu_cur_thread, NULL);
+	preempt_enable();
+	preempt_notifier_dec();
+
+	/*
+	 * Go offline before taking the mutex: a grace period in
+	 * progress holds it and may be waiting for this thread.
+	 */
+	smp_mb();
+	WRITE_ONCE(t->ctr, 0);
+
+	mutex_lock(&toy_rcu_gp_mutex);
+	list_del(&t->node);
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	kfree(t);
+}
+EXPORT_SYMBOL_GPL(toy_rcu_unregister_thread);
+
+/*
+ * A registered thread that waits for a grace period, possibly
+ * behind another updater's, must not hold that one back: it is
+ * in an extended quiescent state until toy_rcu_thread_online().
+ */
+void toy_rcu_thread_offline(void)
+{
+	struct toy_rcu_thread *t;
+
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_thread);
+	if (t) {
+		/* Order prior read-side accesses before going offline. */
+		smp_mb();
+		WRITE_ONCE(t->ctr, 0);
+	}
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_thread_offline);
+
+void toy_rcu_thread_online(void)
+{
+	struct toy_rcu_thread *t;
+
+	preempt_disable();
+	t = this_cpu_read(toy_rcu_cur_thread);
+	if (t) {
+		WRITE_ONCE(t->ctr, READ_ONCE(toy_rcu_gp_ctr));
+		/* Order the report before subsequent read-side accesses. */
+		smp_mb();
+	}
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_thread_online);
+
+static bool toy_rcu_passed(struct toy_rcu_thread *t, unsigned long gp)
+{
+	unsigned long ctr = READ_ONCE(t->ctr);
+
+	return !ctr || ctr == gp;
+}
+
+static void toy_rcu_wait_gp(bool expedited)
+{
+	struct toy_rcu_thread *t;
+	unsigned long gp;
+
+	/* Order the caller's prior updates before the new counter. */
+	smp_mb();
+
+	mutex_lock(&toy_rcu_gp_mutex);
+	gp = toy_rcu_gp_ctr + 1;
+	WRITE_ONCE(toy_rcu_gp_ctr, gp);
+	smp_mb();
+
+	list_for_each_entry(t, &toy_rcu_threads, node) {
+		while (!toy_rcu_passed(t, gp)) {
+			if (expedited)
+				cond_resched();
+			else
+				schedule_timeout_uninterruptible(1);
+		}
+	}
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
+
+void __toy_synchronize_rcu(void)
+{
+	toy_rcu_wait_gp(false);
+}
+
+void __toy_synchronize_rcu_expedited(void)
+{
+	toy_rcu_wait_gp(true);
+}
@@ -0,0 +1,114 @@
+/* TOY SRCU implementation: sleepable, per-domain grace periods
+ *
+ * Readers may block and may migrate between toy_srcu_read_lock()
+ * and toy_srcu_read_unlock(), so a reader cannot decrement the
+ * counter it incremented.  Instead each CPU counts lock and
+ * unlock operations separately for both indexes; the counts
+ * only ever grow, and the readers of an index are gone once
+ * the sum of its unlock counts catches up with the sum of its
+ * lock counts.
+ *
+ * toy_synchronize_srcu() flips the index of the domain twice,
+ * for the same reason as sample_percpu.c does, and waits for
+ * the old index to drain each time.
+ */
+#include <linux/module.h>
+#include <linux/sched.h>
+#include "toy_srcu.h"
+
+int toy_init_srcu_struct(struct toy_srcu_struct *ssp)
+{
+	ssp->completed = 0;
+	mutex_init(&ssp->mutex);
+	ssp->per_cpu_ref = alloc_percpu(struct toy_srcu_array);
+	if (!ssp->per_cpu_ref)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void toy_cleanup_srcu_struct(struct toy_srcu_struct *ssp)
+{
+	free_percpu(ssp->per_cpu_ref);
+	ssp->per_cpu_ref = NULL;
+}
+
+int toy_srcu_read_lock(struct toy_srcu_struct *ssp)
+{
+	int idx;
+
+	idx = READ_ONCE(ssp->completed) & 0x1;
+	this_cpu_inc(ssp->per_cpu_ref->lock_count[idx]);
+	/* Order the increment before the critical section. */
+	smp_mb();
+
+	return idx;
+}
+
+void toy_srcu_read_unlock(struct toy_srcu_struct *ssp, int idx)
+{
+	/* Order the critical section before the increment. */
+	smp_mb();
+	this_cpu_inc(ssp->per_cpu_ref->unlock_count[idx]);
+}
+
+static unsigned long toy_srcu_sum(struct toy_srcu_struct *ssp, int idx,
+				  bool unlock)
+{
+	struct toy_srcu_array *sap;
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		sap = per_cpu_ptr(ssp->per_cpu_ref, cpu);
+		if (unlock)
+			sum += READ_ONCE(sap->unlock_count[idx]);
+		else
+			sum += READ_ONCE(sap->lock_count[idx]);
+	}
+
+	return sum;
+}
+
+static bool toy_srcu_readers_done(struct toy_srcu_struct *ssp, int idx)
+{
+	unsigned long unlocks;
+
+	/*
+	 * Sum the unlocks first: a reader counted there is then
+	 * guaranteed to be counted in the locks as well.
+	 */
+	unlocks = toy_srcu_sum(ssp, idx, true);
+	smp_mb();
+
+	return toy_srcu_sum(ssp, idx, false) == unlocks;
+}
+
+static void toy_srcu_flip_and_wait(struct toy_srcu_struct *ssp)
+{
+	int idx = ssp->completed & 0x1;
+
+	WRITE_ONCE(ssp->completed, ssp->completed + 1);
+	/* Order the flip before checking the old counters. */
+	smp_mb();
+
+	while (!toy_srcu_readers_done(ssp, idx))
+		schedule_timeout_uninterruptible(1);
+
+	/* Order the drained counters before the next phase. */
+	smp_mb();
+}
+
+void toy_synchronize_srcu(struct toy_srcu_struct *ssp)
+{
+	/* Order the caller's prior updates before the flip. */
+	smp_mb();
+
+	mutex_lock(&ssp->mutex);
+	toy_srcu_flip_and_wait(ssp);
+	toy_srcu_flip_and_wait(ssp);
+	mutex_unlock(&ssp->mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
@@ -0,0 +1,227 @@
+/* The sample of toy SRCU
+ *
+ * Two independent domains, each protecting its own struct foo.
+ * The reader of the "slow" domain sleeps inside its read-side
+ * critical section for several seconds, which only the updates
+ * of the slow domain have to wait for: the grace periods of the
+ * "fast" domain stay short.  Each domain has its own writer, so
+ * the fast domain's updates and reclamation never queue up behind
+ * a slow grace period either.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include "toy_rcu.h"
+#include "toy_srcu.h"
+
+struct foo {
+	int a;
+	char b;
+	long c;
+};
+
+struct foo_domain {
+	const char *name;
+	struct foo *gbl_foo;
+	struct toy_srcu_struct srcu;
+	spinlock_t lock;
+	/* How long the reader sleeps inside the critical section. */
+	unsigned long hold;
+};
+
+static struct foo_domain domains[] = {
+	{ .name = "slow", .hold = 5 * HZ },
+	{ .name = "fast", .hold = 0 },
+};
+
+static void foo_update_a(struct foo_domain *d, int new_a)
+{
+	struct foo *new_fp;
+	struct foo *old_fp;
+	u64 t;
+
+	new_fp = kmalloc(sizeof(*new_fp), GFP_KERNEL);
+	if (!new_fp)
+		return;
+
+	spin_lock(&d->lock);
+	old_fp = d->gbl_foo;
+	*new_fp = *old_fp;
+	new_fp->a = new_a;
+	toy_rcu_assign_pointer(d->gbl_foo, new_fp);
+	spin_unlock(&d->lock);
+
+	t = ktime_get_ns();
+	toy_synchronize_srcu(&d->srcu);
+	t = ktime_get_ns() - t;
+	kfree(old_fp);
+
+	pr_info("WRITER-%s:%d(grace period %llu us)\n",
+		d->name, new_a, t / NSEC_PER_USEC);
+}
+
+static int foo_get_a(struct foo_domain *d)
+{
+	int retval;
+	int idx;
+
+	idx = toy_srcu_read_lock(&d->srcu);
+	retval = toy_rcu_dereference(d->gbl_foo)->a;
+	/* Unlike toy_rcu_read_lock(), sleeping is allowed here. */
+	if (d->hold)
+		schedule_timeout_interruptible(d->hold);
+	toy_srcu_read_unlock(&d->srcu, idx);
+
+	return retval;
+}
+
+#define NUM_DOMAINS ARRAY_SIZE(domains)
+#define NUM_THREADS (NUM_DOMAINS * 2)
+
+static struct task_struct *k[NUM_THREADS];
+
+static int kthread_reader(void *arg)
+{
+	struct foo_domain *d = arg;
+	int val;
+
+	while (!kthread_should_stop()) {
+		val = foo_get_a(d);
+		pr_info("READER-%s:%d(%ld)\n", d->name, val, jiffies);
+
+		schedule_timeout_interruptible(HZ);
+	}
+
+	return 0;
+}
+
+static int kthread_writer(void *arg)
+{
+	struct foo_domain *d = arg;
+	int val;
+
+	while (!kthread_should_stop()) {
+		schedule_timeout_interruptible(2 * HZ);
+
+		val = get_random_int() % 100;
+		foo_update_a(d, val);
+	}
+
+	return 0;
+}
+
+static void exit_domains(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		toy_cleanup_srcu_struct(&domains[i].srcu);
+		kfree(domains[i].gbl_foo);
+	}
+}
+
+static int init_domains(void)
+{
+	struct foo_domain *d;
+	int err;
+	int i;
+
+	for (i = 0; i < NUM_DOMAINS; i++) {
+		d = &domains[i];
+		spin_lock_init(&d->lock);
+
+		d->gbl_foo = kzalloc(sizeof(*d->gbl_foo), GFP_KERNEL);
+		if (!d->gbl_foo) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		err = toy_init_srcu_struct(&d->srcu);
+		if (err) {
+			kfree(d->gbl_foo);
+			goto out;
+		}
+	}
+
+	return 0;
+
+out:
+	exit_domains(i);
+	return err;
+}
+
+static void stop_kthreads(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_THREADS; i++)
+		if (k[i])
+			kthread_stop(k[i]);
+}
+
+static int init_kthread(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_DOMAINS; i++) {
+		k[i] = kthread_run(kthread_reader, &domains[i],
+				   "srcu %s reader", domains[i].name);
+		if (IS_ERR(k[i]))
+			goto out;
+	}
+
+	for (; i < NUM_THREADS; i++) {
+		k[i] = kthread_run(kthread_writer, &domains[i - NUM_DOMAINS],
+				   "srcu %s writer", domains[i - NUM_DOMAINS].name);
+		if (IS_ERR(k[i]))
+			goto out;
+	}
+
+	return 0;
+
+out:
+	k[i] = NULL;
+	stop_kthreads();
+	return -1;
+}
+
+static int __init init_sample_toy_srcu(void)
+{
+	int err;
+
+	err = init_domains();
+	if (err)
+		return err;
+
+	err = init_kthread();
+	if (err)
+		goto out;
+
+	pr_info("------------------------\n");
+	pr_info("--- SRCU sample start ---\n");
+
+	return 0;
+
+out:
+	exit_domains(NUM_DOMAINS);
+	return err;
+}
+
+static void __exit exit_sample_toy_srcu(void)
+{
+	stop_kthreads();
+	exit_domains(NUM_DOMAINS);
+
+	pr_info("--- SRCU sample stop ---\n");
+}
+
+MODULE_AUTHOR("Fumiya Shigemitsu");
+MODULE_DESCRIPTION("sample: Using TOY SRCU");
+MODULE_LICENSE("GPL");
+
+module_init(init_sample_toy_srcu)
+module_exit(exit_sample_toy_srcu)
@@ -0,0 +1,243 @@
+/* TOY RCU implementation: hierarchical quiescent-state tree
+ *
+ * Read-side critical sections only disable preemption, so a CPU
+ * that runs anything else from the scheduler's point of view,
+ * e.g. a work item, has left the critical section it was in.
+ *
+ * The flat flavors have the updater look at the state of every
+ * CPU itself.  Here the CPUs are split into leaf groups of
+ * TOY_RCU_FANOUT, and the leaves are grouped the same way under
+ * parent nodes up to a single root, like the rcu_node tree of
+ * Tree RCU.  Each node has a mask of the children that have not
+ * reported a quiescent state yet for the current grace period.
+ *
+ * A grace period only queues the root's kick work and sleeps.
+ * Kicking a node sets its mask and kicks its children; kicking a
+ * leaf queues a work item on each of its online CPUs.  When that
+ * work runs, the CPU clears its bit in its leaf, and the last
+ * child to report to a node reports the node to its parent.  The
+ * root running empty ends the grace period.  The updater does a
+ * constant amount of work, and every CPU only touches its own
+ * leaf and, at most, the nodes on its path to the root, so the
+ * detection latency grows with the depth of the tree, i.e.
+ * logarithmically with the number of CPUs.
+ *
+ * The works run on workqueues of their own, which toy_rcu.ko
+ * destroys at unload: that waits for the works still on their
+ * way out after their report, instead of every grace period.
+ */
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include "toy_rcu.h"
+#include "toy_rcu_flavor.h"
+#include "toy_rcu_trace.h"
+
+#define TOY_RCU_FANOUT 16
+/* Leaves, plus at most as many interior nodes above them. */
+#define TOY_RCU_MAX_NODES (DIV_ROUND_UP(NR_CPUS, TOY_RCU_FANOUT) * 2)
+
+struct toy_rcu_node {
+	spinlock_t lock;
+	/* Children, or CPUs of a leaf, that have yet to report. */
+	unsigned long qsmask;
+	struct toy_rcu_node *parent;
+	/* Bit of this node in the parent's qsmask. */
+	int grpnum;
+	/* Range of CPUs for a leaf, of node indexes otherwise. */
+	int lo;
+	int hi;
+	bool leaf;
+	struct work_struct kick;
+};
+
+static struct toy_rcu_node toy_rcu_nodes[TOY_RCU_MAX_NODES];
+static struct toy_rcu_node *toy_rcu_root;
+static DEFINE_PER_CPU(struct work_struct, toy_rcu_qs_work);
+static DEFINE_MUTEX(toy_rcu_gp_mutex);
+static DECLARE_COMPLETION(toy_rcu_gp_done);
+static struct workqueue_struct *toy_rcu_kick_wq;
+static struct workqueue_struct *toy_rcu_qs_wq;
+
+void toy_rcu_read_lock(void)
+{
+	preempt_disable();
+	trace_toy_rcu_read_lock(_RET_IP_);
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_lock);
+
+void toy_rcu_read_unlock(void)
+{
+	trace_toy_rcu_read_unlock(_RET_IP_);
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(toy_rcu_read_unlock);
+
+/* Clear mask in np and propagate up as long as nodes run empty. */
+static void toy_rcu_report(struct toy_rcu_node *np, unsigned long mask)
+{
+	unsigned long flags;
+	unsigned long left;
+
+	for (;;) {
+		spin_lock_irqsave(&np->lock, flags);
+		np->qsmask &= ~mask;
+		left = np->qsmask;
+		spin_unlock_irqrestore(&np->lock, flags);
+
+		if (left)
+			return;
+		if (!np->parent)
+			break;
+		mask = BIT(np->grpnum);
+		np = np->parent;
+	}
+
+	complete(&toy_rcu_gp_done);
+}
+
+static void toy_rcu_qs_work_fn(struct work_struct *work)
+{
+	int cpu = smp_processor_id();
+	struct toy_rcu_node *np = &toy_rcu_nodes[cpu / TOY_RCU_FANOUT];
+
+	/* Order the critical sections that ended here before the report. */
+	smp_mb();
+	toy_rcu_report(np, BIT(cpu - np->lo));
+}
+
+static void toy_rcu_kick_fn(struct work_struct *work)
+{
+	struct toy_rcu_node *np = container_of(work, struct toy_rcu_node, kick);
+	unsigned long mask = 0;
+	int i;
+
+	if (np->leaf) {
+		for (i = np->lo; i < np->hi; i++)
+			if (cpu_online(i))
+				mask |= BIT(i - np->lo);
+	} else {
+		mask = GENMASK(np->hi - np->lo - 1, 0);
+	}
+
+	spin_lock_irq(&np->lock);
+	np->qsmask = mask;
+	spin_unlock_irq(&np->lock);
+
+	/* A leaf with no online CPU is quiescent right away. */
+	if (!mask) {
+		toy_rcu_report(np, 0);
+		return;
+	}
+
+	/*
+	 * The grace period cannot end before the last child is
+	 * queued, so nothing here races with the next one.
+	 */
+	for (i = np->lo; i < np->hi; i++) {
+		if (!np->leaf)
+			queue_work(toy_rcu_kick_wq, &toy_rcu_nodes[i].kick);
+		else if (cpu_online(i))
+			queue_work_on(i, toy_rcu_qs_wq,
+				      per_cpu_ptr(&toy_rcu_qs_work, i));
+	}
+}
+
+/* Lay out the leaves first, then each level above, root last. */
+static void toy_rcu_tree_init(void)
+{
+	struct toy_rcu_node *np;
+	int first = 0;
+	int n;
+	int i;
+	int cpu;
+
+	n = DIV_ROUND_UP(nr_cpu_ids, TOY_RCU_FANOUT);
+	for (i = 0; i < n; i++) {
+		np = &toy_rcu_nodes[i];
+		np->leaf = true;
+		np->lo = i * TOY_RCU_FANOUT;
+		np->hi = min_t(int, np->lo + TOY_RCU_FANOUT, nr_cpu_ids);
+	}
+
+	while (n > 1) {
+		for (i = 0; i < DIV_ROUND_UP(n, TOY_RCU_FANOUT); i++) {
+			np = &toy_rcu_nodes[first + n + i];
+			np->lo = first + i * TOY_RCU_FANOUT;
+			np->hi = min(np->lo + TOY_RCU_FANOUT, first + n);
+		}
+		first += n;
+		n = DIV_ROUND_UP(n, TOY_RCU_FANOUT);
+	}
+	toy_rcu_root = &toy_rcu_nodes[first];
+
+	for (np = toy_rcu_nodes; np <= toy_rcu_root; np++) {
+		spin_lock_init(&np->lock);
+		INIT_WORK(&np->kick, toy_rcu_kick_fn);
+		if (np->leaf)
+			continue;
+		for (i = np->lo; i < np->hi; i++) {
+			toy_rcu_nodes[i].parent = np;
+			toy_rcu_nodes[i].grpnum = i - np->lo;
+		}
+	}
+
+	for_each_possible_cpu(cpu)
+		INIT_WORK(per_cpu_ptr(&toy_rcu_qs_work, cpu),
+			  toy_rcu_qs_work_fn);
+}
+
+int __toy_rcu_flavor_init(void)
+{
+	toy_rcu_kick_wq = alloc_workqueue("toy_rcu_kick", WQ_UNBOUND, 0);
+	if (!toy_rcu_kick_wq)
+		return -ENOMEM;
+
+	toy_rcu_qs_wq = alloc_workqueue("toy_rcu_qs", WQ_HIGHPRI, 0);
+	if (!toy_rcu_qs_wq) {
+		destroy_workqueue(toy_rcu_kick_wq);
+		return -ENOMEM;
+	}
+
+	toy_rcu_tree_init();
+
+	return 0;
+}
+
+void __toy_rcu_flavor_exit(void)
+{
+	destroy_workqueue(toy_rcu_qs_wq);
+	destroy_workqueue(toy_rcu_kick_wq);
+}
+
+void __toy_synchronize_rcu(void)
+{
+	/* Order the caller's prior updates before the grace period. */
+	smp_mb();
+
+	mutex_lock(&toy_rcu_gp_mutex);
+
+	/* Keep the online CPUs stable while the leaves are kicked. */
+	cpus_read_lock();
+	reinit_completion(&toy_rcu_gp_done);
+	queue_work(toy_rcu_kick_wq, &toy_rcu_root->kick);
+	wait_for_completion(&toy_rcu_gp_done);
+	cpus_read_unlock();
+
+	mutex_unlock(&toy_rcu_gp_mutex);
+
+	/* Order the grace period before the caller's reclamation. */
+	smp_mb();
+}
+
+/*
+ * Every CPU is already made to pass through the scheduler
+ * right away, there is no passive waiting to cut short here.
+ */
+void __toy_synchronize_rcu_expedited(void)
+{
+	__toy_synchronize_rcu();
+}
@@ -2,49 +2,215 @@
 #include <linux/slab.h>
 #include <linux/kthread.h>
 #include <linux/random.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
 #include "toy_rcu.h"
+#include "foo_cache.h"
 #include "utils.h"
 
 struct foo {
 	int a;
 	char b;
 	long c;
+	struct list_head retired;
+	unsigned long cookie;
 };
 DEFINE_SPINLOCK(foo_mutex);
+/* Old copies waiting for their grace period, oldest first. */
+static LIST_HEAD(foo_retired);
 /*
  * #define __rcu 	__attribute__((noderef, address_space(4)))
  */
 struct foo __rcu *gbl_foo;
 
+/*
+ * With numa=1, every possible node gets its own replica of
+ * gbl_foo, allocated on that node when it has memory, and
+ * readers only touch the replica of the node they run on.
+ * Possible rather than online nodes, so that a node coming
+ * online or going away in the middle of an update never finds
+ * its slot empty.  An update publishes a new copy on every
+ * node, so readers on different nodes may briefly disagree, as
+ * a reader may see the old value anyway until the update is done.
+ */
+static bool numa;
+module_param(numa, bool, 0444);
+MODULE_PARM_DESC(numa, "Keep a replica of gbl_foo per NUMA node");
+
+static struct foo __rcu *gbl_foo_node[MAX_NUMNODES];
+
+static void foo_free(struct foo *fp)
+{
+	if (numa)
+		kfree(fp);
+	else
+		foo_cache_free(fp);
+}
+
+/* Nodes without memory get their replica from a nearby one. */
+static int foo_node_alloc_nid(int nid)
+{
+	return node_state(nid, N_MEMORY) ? nid : NUMA_NO_NODE;
+}
+
+static int init_foo_numa(void)
+{
+	struct foo *fp;
+	int nid;
+
+	for_each_node(nid) {
+		fp = kzalloc_node(sizeof(*fp), GFP_KERNEL,
+				  foo_node_alloc_nid(nid));
+		if (!fp)
+			return -ENOMEM;
+
+		fp->a = 5;
+		RCU_INIT_POINTER(gbl_foo_node[nid], fp);
+	}
+
+	return 0;
+}
+
+static void exit_foo_numa(void)
+{
+	int nid;
+
+	for_each_node(nid)
+		kfree(rcu_dereference_protected(gbl_foo_node[nid], 1));
+}
+
 static int init_foo(void)
 {
-	gbl_foo = kmalloc(sizeof(*gbl_foo), GFP_KERNEL);
-	if (!gbl_foo)
+	int err;
+
+	if (numa) {
+		err = init_foo_numa();
+		if (err)
+			exit_foo_numa();
+		return err;
+	}
+
+	err = foo_cache_init("toy_foo", sizeof(struct foo));
+	if (err)
+		return err;
+
+	gbl_foo = foo_cache_alloc(GFP_KERNEL);
+	if (!gbl_foo) {
+		foo_cache_exit();
 		return -1;
+	}
 
 	gbl_foo->a = 5;
 
 	return 0;
 }
 
+static void exit_foo(void)
+{
+	if (numa) {
+		exit_foo_numa();
+		return;
+	}
+
+	foo_cache_free(gbl_foo);
+	foo_cache_exit();
+}
+
+/*
+ * Free the retired copies whose grace period has already
+ * elapsed.  Cookies are taken in retirement order, so stop at
+ * the first one that is still pending.
+ */
+static void foo_reclaim_retired(void)
+{
+	struct foo *fp;
+	struct foo *n;
+
+	list_for_each_entry_safe(fp, n, &foo_retired, retired) {
+		if (!toy_poll_state_synchronize_rcu(fp->cookie))
+			break;
+		list_del(&fp->retired);
+		foo_free(fp);
+	}
+}
+
+/* Replace the replica of every node, under one grace period. */
+static void foo_update_a_numa(int new_a)
+{
+	LIST_HEAD(fresh);
+	LIST_HEAD(old);
+	struct foo *new_fp;
+	struct foo *old_fp;
+	struct foo *n;
+	unsigned long cookie;
+	int nid;
+
+	/* Allocate every replica up front, the spinlock cannot sleep. */
+	for_each_node(nid) {
+		new_fp = kmalloc_node(sizeof(*new_fp), GFP_KERNEL,
+				      foo_node_alloc_nid(nid));
+		if (!new_fp)
+			goto out;
+		list_add_tail(&new_fp->retired, &fresh);
+	}
+
+	spin_lock(&foo_mutex);
+	foo_reclaim_retired();
+
+	for_each_node(nid) {
+		new_fp = list_first_entry(&fresh, struct foo, retired);
+		list_del(&new_fp->retired);
+
+		old_fp = rcu_dereference_protected(gbl_foo_node[nid],
+						   lockdep_is_held(&foo_mutex));
+		*new_fp = *old_fp;
+		new_fp->a = new_a;
+		rcu_assign_pointer(gbl_foo_node[nid], new_fp);
+		list_add_tail(&old_fp->retired, &old);
+	}
+
+	/* One grace period covers the old replicas of all nodes. */
+	cookie = toy_start_poll_synchronize_rcu();
+	list_for_each_entry(old_fp, &old, retired)
+		old_fp->cookie = cookie;
+	list_splice_tail(&old, &foo_retired);
+	spin_unlock(&foo_mutex);
+
+out:
+	list_for_each_entry_safe(new_fp, n, &fresh, retired)
+		kfree(new_fp);
+}
+
+/*
+ * The updater never waits for a grace period: the old structure
+ * is tagged with a grace-period cookie and freed by a later
+ * update once that grace period has elapsed.
+ */
 void foo_update_a(int new_a)
 {
 	struct foo *new_fp;
 	struct foo *old_fp;
 
+	if (numa) {
+		foo_update_a_numa(new_a);
+		return;
+	}
+
 	//START_THREAD;
 
-	new_fp = kmalloc(sizeof(*new_fp), GFP_KERNEL);
+	new_fp = foo_cache_alloc(GFP_KERNEL);
 
 	spin_lock(&foo_mutex);
+	foo_reclaim_retired();
+
 	old_fp = rcu_dereference(gbl_foo);
 	*new_fp = *old_fp;
 	new_fp->a = new_a;
 	rcu_assign_pointer(gbl_foo, new_fp);
-	spin_unlock(&foo_mutex);
 
-	toy_synchronize_rcu();
-	kfree(old_fp);
+	old_fp->cookie = toy_start_poll_synchronize_rcu();
+	list_add_tail(&old_fp->retired, &foo_retired);
+	spin_unlock(&foo_mutex);
 
 	//END_THREAD;
 }
@@ -56,7 +222,14 @@ int foo_get_a(void)
 	//START_THREAD;
 
 	toy_rcu_read_lock();
-	retval = rcu_dereference(gbl_foo)->a;
+	/*
+	 * Any replica is valid, so it does not matter if the reader
+	 * migrates to another node after numa_node_id().
+	 */
+	if (numa)
+		retval = rcu_dereference(gbl_foo_node[numa_node_id()])->a;
+	else
+		retval = rcu_dereference(gbl_foo)->a;
 	toy_rcu_read_unlock();
 
 	//END_THREAD;
@@ -71,6 +244,8 @@ static struct task_struct *k[NUM_THREADS];
 
 static int kthread_reader(void *arg)
 {
+	int err;
+
 	void kthread_reader_main(void)
 	{
 		int seed;
@@ -89,8 +264,17 @@ static int kthread_reader(void *arg)
 		END_THREAD;
 	}
 
-	while (!kthread_should_stop())
+	err = toy_rcu_register_thread();
+	if (err)
+		return err;
+
+	/* Nothing is referenced between two iterations. */
+	while (!kthread_should_stop()) {
 		kthread_reader_main();
+		toy_rcu_quiescent_state();
+	}
+
+	toy_rcu_unregister_thread();
 
 	return 0;
 }
@@ -157,17 +341,23 @@ static int __init init_sample_toy_rcu(void)
 	if (err)
 		return err;
 
-	err = init_kthread();
+	err = toy_rcu_init();
 	if (err)
 		goto out;
 
+	err = init_kthread();
+	if (err)
+		goto out_toy_rcu;
+
 	pr_info("------------------------\n");
 	pr_info("--- RCU sample start ---\n");
 
 	return 0;
 
+out_toy_rcu:
+	toy_rcu_exit();
 out:
-	kfree(gbl_foo);
+	exit_foo();
 	return err;
 }
 
@@ -178,7 +368,11 @@ static void __exit exit_sample_toy_rcu(void)
 	for (i = 0; i < NUM_THREADS; i++)
 		kthread_stop(k[i]);
 
-	kfree(gbl_foo);
+	toy_synchronize_rcu();
+	foo_reclaim_retired();
+
+	toy_rcu_exit();
+	exit_foo();
 
 	pr_info("--- RCU sample stop ---\n");
 }
@@ -0,0 +1,51 @@
+#ifndef __TOY_EBR_H_
+#define __TOY_EBR_H_
+
+#include <linux/percpu.h>
+#include <linux/preempt.h>
+
+/*
+ * TOY epoch-based reclamation, see sample_ebr.c.
+ *
+ * Entering a read-side critical section stores the global epoch
+ * in a per-CPU slot, leaving it clears the slot.  Retired objects
+ * wait on per-CPU limbo lists until the global epoch moved two
+ * steps past the epoch they were retired in.
+ */
+struct toy_ebr_reader {
+	/* Announced epoch << 1 | 1 while in a critical section, or 0. */
+	unsigned long state;
+	int nesting;
+};
+
+DECLARE_PER_CPU(struct toy_ebr_reader, toy_ebr_reader);
+extern unsigned long toy_ebr_epoch;
+
+static inline void toy_ebr_read_lock(void)
+{
+	struct toy_ebr_reader *r;
+
+	preempt_disable();
+	r = this_cpu_ptr(&toy_ebr_reader);
+	if (r->nesting++ == 0) {
+		WRITE_ONCE(r->state, READ_ONCE(toy_ebr_epoch) << 1 | 1);
+		/* Order the announcement before the critical section. */
+		smp_mb();
+	}
+}
+
+static inline void toy_ebr_read_unlock(void)
+{
+	struct toy_ebr_reader *r = this_cpu_ptr(&toy_ebr_reader);
+
+	if (--r->nesting == 0)
+		smp_store_release(&r->state, 0);
+	preempt_enable();
+}
+
+void toy_ebr_retire(struct rcu_head *head, rcu_callback_t func);
+bool toy_ebr_try_advance(void);
+int toy_ebr_init(void);
+void toy_ebr_exit(void);
+
+#endif
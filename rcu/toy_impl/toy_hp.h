@@ -0,0 +1,38 @@
+#ifndef __TOY_HP_H_
+#define __TOY_HP_H_
+
+/*
+ * TOY hazard pointers, see sample_hazard.c.
+ *
+ * Same shape as toy_rcu.h: readers protect a pointer instead of
+ * entering a critical section, updaters retire the old object
+ * instead of waiting for a grace period.  An object is freed by
+ * a later scan once no hazard slot points to it anymore, so the
+ * number of retired objects stays bounded even if a reader stalls.
+ */
+#define TOY_HP_SLOTS 2
+
+struct toy_hp_head {
+	struct toy_hp_head *next;
+	void *ptr;
+	void (*func)(struct toy_hp_head *head);
+};
+
+void *__toy_hp_protect(int slot, void **pp);
+void toy_hp_clear(int slot);
+void toy_hp_retire(struct toy_hp_head *head, void *ptr,
+		   void (*func)(struct toy_hp_head *head));
+void toy_hp_scan(void);
+int toy_hp_init(void);
+void toy_hp_exit(void);
+
+/*
+ * Load *pp and protect the result with hazard slot 'slot' of the
+ * current CPU.  Preemption stays disabled until toy_hp_clear().
+ */
+#define toy_hp_protect(slot, pp) \
+	({ \
+		(typeof(*(pp)))__toy_hp_protect((slot), (void **)(pp)); \
+	})
+
+#endif
@@ -1,9 +1,44 @@
 #ifndef __TOY_RCU_H_
 #define __TOY_RCU_H_
 
+#ifdef TOY_RCU_QSBR
+/*
+ * QSBR readers pay nothing: they announce quiescent states
+ * explicitly instead, see sample_qsbr.c.
+ */
+static inline void toy_rcu_read_lock(void) { }
+static inline void toy_rcu_read_unlock(void) { }
+void toy_rcu_quiescent_state(void);
+int toy_rcu_register_thread(void);
+void toy_rcu_unregister_thread(void);
+void toy_rcu_thread_offline(void);
+void toy_rcu_thread_online(void);
+#else
 void toy_rcu_read_lock(void);
 void toy_rcu_read_unlock(void);
+static inline void toy_rcu_quiescent_state(void) { }
+static inline void toy_rcu_thread_offline(void) { }
+static inline void toy_rcu_thread_online(void) { }
+#ifdef TOY_RCU_PREEMPT
+/*
+ * Preemptible readers keep their nesting in per-thread state,
+ * see sample_preempt.c.
+ */
+int toy_rcu_register_thread(void);
+void toy_rcu_unregister_thread(void);
+#else
+static inline int toy_rcu_register_thread(void) { return 0; }
+static inline void toy_rcu_unregister_thread(void) { }
+#endif
+#endif
 void toy_synchronize_rcu(void);
+void toy_synchronize_rcu_expedited(void);
+unsigned long toy_get_state_synchronize_rcu(void);
+unsigned long toy_start_poll_synchronize_rcu(void);
+bool toy_poll_state_synchronize_rcu(unsigned long cookie);
+void toy_call_rcu(struct rcu_head *head, rcu_callback_t func);
+int toy_rcu_init(void);
+void toy_rcu_exit(void);
 /*
  * rcu_assign_pointer() is implemented as a macro,
  * though it would be cool to be able to declare
@@ -0,0 +1,28 @@
+#ifndef __TOY_RCU_FLAVOR_H_
+#define __TOY_RCU_FLAVOR_H_
+
+/*
+ * Implemented by each toy flavor: drive one full grace period.
+ * Callers go through toy_synchronize_rcu() in sample_gp.c, which
+ * lets concurrent callers share grace periods.
+ */
+void __toy_synchronize_rcu(void);
+/*
+ * Drive a grace period as fast as the flavor can, for
+ * toy_synchronize_rcu_expedited() in sample_gp.c.
+ */
+void __toy_synchronize_rcu_expedited(void);
+
+/*
+ * Set up and tear down the flavor, from the init and exit of
+ * toy_rcu.ko.  Only the tree flavor has anything to do there.
+ */
+#ifdef TOY_RCU_TREE
+int __toy_rcu_flavor_init(void);
+void __toy_rcu_flavor_exit(void);
+#else
+static inline int __toy_rcu_flavor_init(void) { return 0; }
+static inline void __toy_rcu_flavor_exit(void) { }
+#endif
+
+#endif
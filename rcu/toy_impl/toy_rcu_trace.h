@@ -0,0 +1,114 @@
+/*
+ * Tracepoints of the toy RCU, instantiated in sample_gp.c.
+ *
+ * e.g. the grace-period latency distribution of a running sample,
+ * normal and expedited apart:
+ *   echo 'hist:keys=expedited,duration_ns.log2' > \
+ *     /sys/kernel/tracing/events/toy_rcu/toy_rcu_gp_end/trigger
+ *   cat /sys/kernel/tracing/events/toy_rcu/toy_rcu_gp_end/hist
+ *
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM toy_rcu
+
+#if !defined(_TOY_RCU_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TOY_RCU_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(toy_rcu_reader,
+
+	TP_PROTO(unsigned long ip),
+
+	TP_ARGS(ip),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, ip)
+	),
+
+	TP_fast_assign(
+		__entry->ip = ip;
+	),
+
+	TP_printk("caller=%pS", (void *)__entry->ip)
+);
+
+DEFINE_EVENT(toy_rcu_reader, toy_rcu_read_lock,
+	TP_PROTO(unsigned long ip),
+	TP_ARGS(ip)
+);
+
+DEFINE_EVENT(toy_rcu_reader, toy_rcu_read_unlock,
+	TP_PROTO(unsigned long ip),
+	TP_ARGS(ip)
+);
+
+/* Expedited grace periods number their own sequence. */
+TRACE_EVENT(toy_rcu_gp_start,
+
+	TP_PROTO(unsigned long gp_seq, bool expedited),
+
+	TP_ARGS(gp_seq, expedited),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, gp_seq)
+		__field(bool, expedited)
+	),
+
+	TP_fast_assign(
+		__entry->gp_seq = gp_seq;
+		__entry->expedited = expedited;
+	),
+
+	TP_printk("gp_seq=%lu expedited=%d", __entry->gp_seq,
+		  __entry->expedited)
+);
+
+TRACE_EVENT(toy_rcu_gp_end,
+
+	TP_PROTO(unsigned long gp_seq, u64 duration_ns, bool expedited),
+
+	TP_ARGS(gp_seq, duration_ns, expedited),
+
+	TP_STRUCT__entry(
+		__field(unsigned long, gp_seq)
+		__field(u64, duration_ns)
+		__field(bool, expedited)
+	),
+
+	TP_fast_assign(
+		__entry->gp_seq = gp_seq;
+		__entry->duration_ns = duration_ns;
+		__entry->expedited = expedited;
+	),
+
+	TP_printk("gp_seq=%lu duration_ns=%llu expedited=%d", __entry->gp_seq,
+		  __entry->duration_ns, __entry->expedited)
+);
+
+TRACE_EVENT(toy_rcu_invoke_callback,
+
+	TP_PROTO(struct rcu_head *rhp),
+
+	TP_ARGS(rhp),
+
+	TP_STRUCT__entry(
+		__field(void *, rhp)
+		__field(void *, func)
+	),
+
+	TP_fast_assign(
+		__entry->rhp = rhp;
+		__entry->func = rhp->func;
+	),
+
+	TP_printk("rhp=%p func=%ps", __entry->rhp, __entry->func)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE toy_rcu_trace
+#include <trace/define_trace.h>
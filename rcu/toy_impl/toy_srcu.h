@@ -0,0 +1,30 @@
+#ifndef __TOY_SRCU_H_
+#define __TOY_SRCU_H_
+
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+
+/*
+ * Sleepable TOY RCU, see sample_srcu.c.
+ *
+ * Each toy_srcu_struct is an independent domain: a grace period
+ * of one domain only waits for the readers of that domain.
+ */
+struct toy_srcu_array {
+	unsigned long lock_count[2];
+	unsigned long unlock_count[2];
+};
+
+struct toy_srcu_struct {
+	unsigned long completed;
+	struct toy_srcu_array __percpu *per_cpu_ref;
+	struct mutex mutex;
+};
+
+int toy_init_srcu_struct(struct toy_srcu_struct *ssp);
+void toy_cleanup_srcu_struct(struct toy_srcu_struct *ssp);
+int toy_srcu_read_lock(struct toy_srcu_struct *ssp);
+void toy_srcu_read_unlock(struct toy_srcu_struct *ssp, int idx);
+void toy_synchronize_srcu(struct toy_srcu_struct *ssp);
+
+#endif
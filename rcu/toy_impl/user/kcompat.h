@@ -0,0 +1,42 @@
+#ifndef __KCOMPAT_H_
+#define __KCOMPAT_H_
+
+/*
+ * The few kernel definitions toy_rcu.h and the samples need,
+ * mapped onto C11 atomics and pthreads for the userspace build.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <limits.h>
+
+#define barrier()		__asm__ __volatile__("" : : : "memory")
+#define smp_mb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define READ_ONCE(x)		(*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile typeof(x) *)&(x) = (v))
+
+#define smp_store_release(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define smp_load_acquire(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+#define ULONG_CMP_GE(a, b)	(ULONG_MAX / 2 >= (a) - (b))
+#define ULONG_CMP_LT(a, b)	(ULONG_MAX / 2 < (a) - (b))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define __rcu
+#define rcu_dereference(p)	READ_ONCE(p)
+#define rcu_assign_pointer(p, v) smp_store_release(&(p), (v))
+
+#define pr_info(fmt, ...)	printf(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)	fprintf(stderr, fmt, ##__VA_ARGS__)
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+#endif
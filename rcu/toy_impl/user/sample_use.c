@@ -0,0 +1,203 @@
+/* The sample_use.c workload in userspace
+ *
+ * Reader threads call foo_get_a() in a tight loop and a writer
+ * calls foo_update_a() every interval, retiring the old copies
+ * with polled cookies like the module does.  Prints reads/sec and
+ * updates/sec at the end, e.g. for reader scaling:
+ *
+ *   for n in 1 2 4 8 16; do ./sample_use -r $n -d 5; done
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "kcompat.h"
+#include "toy_rcu.h"
+
+struct foo {
+	int a;
+	char b;
+	long c;
+	struct foo *retired;
+	unsigned long cookie;
+};
+
+static pthread_mutex_t foo_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Old copies waiting for their grace period, oldest first. */
+static struct foo *foo_retired;
+static struct foo **foo_retired_tail = &foo_retired;
+struct foo __rcu *gbl_foo;
+
+static int nreaders = 2;
+static int duration = 5;
+static int interval_us = 1000;
+static bool stop;
+
+struct foo_thread {
+	pthread_t tid;
+	unsigned long ops;
+	int sink;
+};
+
+static void foo_reclaim_retired(void)
+{
+	struct foo *fp;
+
+	while ((fp = foo_retired) &&
+	       toy_poll_state_synchronize_rcu(fp->cookie)) {
+		foo_retired = fp->retired;
+		if (!foo_retired)
+			foo_retired_tail = &foo_retired;
+		free(fp);
+	}
+}
+
+void foo_update_a(int new_a)
+{
+	struct foo *new_fp;
+	struct foo *old_fp;
+
+	new_fp = malloc(sizeof(*new_fp));
+	if (!new_fp)
+		return;
+
+	pthread_mutex_lock(&foo_mutex);
+	foo_reclaim_retired();
+
+	old_fp = rcu_dereference(gbl_foo);
+	*new_fp = *old_fp;
+	new_fp->a = new_a;
+	rcu_assign_pointer(gbl_foo, new_fp);
+
+	old_fp->cookie = toy_start_poll_synchronize_rcu();
+	old_fp->retired = NULL;
+	*foo_retired_tail = old_fp;
+	foo_retired_tail = &old_fp->retired;
+	pthread_mutex_unlock(&foo_mutex);
+}
+
+int foo_get_a(void)
+{
+	int retval;
+
+	toy_rcu_read_lock();
+	retval = rcu_dereference(gbl_foo)->a;
+	toy_rcu_read_unlock();
+
+	return retval;
+}
+
+static void *thread_reader(void *arg)
+{
+	struct foo_thread *ft = arg;
+	unsigned long ops = 0;
+	int sink = 0;
+
+	toy_rcu_register_thread();
+
+	while (!READ_ONCE(stop)) {
+		sink += foo_get_a();
+		ops++;
+	}
+
+	toy_rcu_unregister_thread();
+
+	ft->ops = ops;
+	ft->sink = sink;
+
+	return NULL;
+}
+
+static void *thread_writer(void *arg)
+{
+	struct foo_thread *ft = arg;
+	unsigned int seed = 1;
+
+	while (!READ_ONCE(stop)) {
+		foo_update_a(rand_r(&seed) % 100);
+		ft->ops++;
+		if (interval_us)
+			usleep(interval_us);
+	}
+
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct foo_thread *threads;
+	struct foo_thread writer = { 0 };
+	unsigned long reads = 0;
+	double elapsed;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "r:d:i:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nreaders = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'i':
+			interval_us = atoi(optarg);
+			break;
+		default:
+			pr_err("Usage: %s [-r readers] [-d seconds] [-i update interval us]\n",
+			       argv[0]);
+			return 1;
+		}
+	}
+
+	gbl_foo = calloc(1, sizeof(*gbl_foo));
+	threads = calloc(nreaders, sizeof(*threads));
+	if (!gbl_foo || !threads)
+		return 1;
+	gbl_foo->a = 5;
+
+	if (toy_rcu_init())
+		return 1;
+
+	elapsed = now();
+	for (i = 0; i < nreaders; i++)
+		pthread_create(&threads[i].tid, NULL, thread_reader, &threads[i]);
+	pthread_create(&writer.tid, NULL, thread_writer, &writer);
+
+	sleep(duration);
+	WRITE_ONCE(stop, true);
+
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(threads[i].tid, NULL);
+		reads += threads[i].ops;
+	}
+	pthread_join(writer.tid, NULL);
+	elapsed = now() - elapsed;
+
+	toy_synchronize_rcu();
+	pthread_mutex_lock(&foo_mutex);
+	foo_reclaim_retired();
+	pthread_mutex_unlock(&foo_mutex);
+
+	toy_rcu_exit();
+	free(gbl_foo);
+	free(threads);
+
+	pr_info("readers: %d duration: %ds interval: %dus\n",
+		nreaders, duration, interval_us);
+	pr_info("reads/sec: %.0f\n", reads / elapsed);
+	pr_info("updates/sec: %.0f\n", writer.ops / elapsed);
+
+	return 0;
+}
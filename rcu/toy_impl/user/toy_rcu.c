@@ -0,0 +1,286 @@
+/* TOY RCU implementation: userspace, membarrier
+ *
+ * The toy_rcu.h API for pthreads, built with TOY_RCU_PREEMPT
+ * since readers are preemptible and keep their state per thread.
+ *
+ * Each registered thread has a counter that holds its nesting
+ * depth and, while it is inside a critical section, the phase of
+ * the global counter it entered with.  Readers only store to
+ * their own counter and use compiler barriers: the updater calls
+ * membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED), which makes every
+ * running thread of the process execute a full memory barrier,
+ * in place of the smp_mb() the readers of sample_percpu.c pay for.
+ *
+ * The grace period flips the phase twice and waits each time for
+ * the readers that are still in the old one, for the same reason
+ * as sample_percpu.c does.  Grace-period sharing, polled cookies
+ * and toy_call_rcu() mirror sample_gp.c and sample_callback.c,
+ * with a reclaimer pthread instead of a kthread.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#include "kcompat.h"
+#include "toy_rcu.h"
+
+#define TOY_RCU_NEST_MASK	((1UL << (sizeof(long) * 4)) - 1)
+#define TOY_RCU_PHASE		(1UL << (sizeof(long) * 4))
+
+struct toy_rcu_reader {
+	unsigned long ctr;
+	struct toy_rcu_reader *next;
+};
+
+static __thread struct toy_rcu_reader toy_rcu_self;
+static struct toy_rcu_reader *toy_rcu_readers;
+/* Nesting count of 1 in the current phase. */
+static unsigned long toy_rcu_gp_ctr = 1;
+static pthread_mutex_t toy_rcu_gp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long toy_rcu_gp_seq;
+static pthread_mutex_t toy_rcu_gp_seq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rcu_head *toy_rcu_cb_head;
+static struct rcu_head **toy_rcu_cb_tail = &toy_rcu_cb_head;
+static unsigned long toy_rcu_gp_needed;
+static bool toy_rcu_stop;
+static pthread_mutex_t toy_rcu_cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t toy_rcu_cb_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t toy_rcu_reclaimer;
+
+static int membarrier(int cmd)
+{
+	return syscall(__NR_membarrier, cmd, 0, 0);
+}
+
+/* A full barrier on every running thread of the process. */
+static void toy_rcu_mb_all(void)
+{
+	membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED);
+}
+
+void toy_rcu_read_lock(void)
+{
+	unsigned long tmp = toy_rcu_self.ctr;
+
+	if (!(tmp & TOY_RCU_NEST_MASK))
+		WRITE_ONCE(toy_rcu_self.ctr, READ_ONCE(toy_rcu_gp_ctr));
+	else
+		WRITE_ONCE(toy_rcu_self.ctr, tmp + 1);
+	/* Made a full barrier by toy_rcu_mb_all() in the updater. */
+	barrier();
+}
+
+void toy_rcu_read_unlock(void)
+{
+	barrier();
+	WRITE_ONCE(toy_rcu_self.ctr, toy_rcu_self.ctr - 1);
+}
+
+int toy_rcu_register_thread(void)
+{
+	pthread_mutex_lock(&toy_rcu_gp_mutex);
+	toy_rcu_self.ctr = 0;
+	toy_rcu_self.next = toy_rcu_readers;
+	toy_rcu_readers = &toy_rcu_self;
+	pthread_mutex_unlock(&toy_rcu_gp_mutex);
+
+	return 0;
+}
+
+/* Must be called outside of any read-side critical section. */
+void toy_rcu_unregister_thread(void)
+{
+	struct toy_rcu_reader **rp;
+
+	pthread_mutex_lock(&toy_rcu_gp_mutex);
+	for (rp = &toy_rcu_readers; *rp; rp = &(*rp)->next) {
+		if (*rp == &toy_rcu_self) {
+			*rp = toy_rcu_self.next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&toy_rcu_gp_mutex);
+}
+
+static bool toy_rcu_in_old_phase(struct toy_rcu_reader *r)
+{
+	unsigned long v = READ_ONCE(r->ctr);
+
+	return (v & TOY_RCU_NEST_MASK) && ((v ^ toy_rcu_gp_ctr) & TOY_RCU_PHASE);
+}
+
+static void toy_rcu_flip_and_wait(void)
+{
+	struct toy_rcu_reader *r;
+
+	WRITE_ONCE(toy_rcu_gp_ctr, toy_rcu_gp_ctr ^ TOY_RCU_PHASE);
+	/* Order the flip before checking the readers. */
+	smp_mb();
+
+	for (r = toy_rcu_readers; r; r = r->next)
+		while (toy_rcu_in_old_phase(r))
+			sched_yield();
+
+	/* Order the drained readers before the next phase. */
+	smp_mb();
+}
+
+static void __toy_synchronize_rcu(void)
+{
+	pthread_mutex_lock(&toy_rcu_gp_mutex);
+	/* Order the caller's updates and the readers' counters. */
+	toy_rcu_mb_all();
+	toy_rcu_flip_and_wait();
+	toy_rcu_flip_and_wait();
+	/* Order the grace period before the caller's reclamation. */
+	toy_rcu_mb_all();
+	pthread_mutex_unlock(&toy_rcu_gp_mutex);
+}
+
+static unsigned long toy_rcu_seq_snap(void)
+{
+	smp_mb();
+
+	return (READ_ONCE(toy_rcu_gp_seq) + 3) & ~0x1UL;
+}
+
+static bool toy_rcu_seq_done(unsigned long s)
+{
+	return ULONG_CMP_GE(READ_ONCE(toy_rcu_gp_seq), s);
+}
+
+void toy_synchronize_rcu(void)
+{
+	unsigned long s;
+
+	s = toy_rcu_seq_snap();
+
+	pthread_mutex_lock(&toy_rcu_gp_seq_mutex);
+	if (!toy_rcu_seq_done(s)) {
+		WRITE_ONCE(toy_rcu_gp_seq, toy_rcu_gp_seq + 1);
+		__toy_synchronize_rcu();
+		smp_store_release(&toy_rcu_gp_seq, toy_rcu_gp_seq + 1);
+	}
+	pthread_mutex_unlock(&toy_rcu_gp_seq_mutex);
+
+	smp_mb();
+}
+
+/* membarrier() is already as fast as it gets. */
+void toy_synchronize_rcu_expedited(void)
+{
+	toy_synchronize_rcu();
+}
+
+unsigned long toy_get_state_synchronize_rcu(void)
+{
+	return toy_rcu_seq_snap();
+}
+
+bool toy_poll_state_synchronize_rcu(unsigned long cookie)
+{
+	bool done = toy_rcu_seq_done(cookie);
+
+	smp_mb();
+
+	return done;
+}
+
+unsigned long toy_start_poll_synchronize_rcu(void)
+{
+	unsigned long cookie;
+
+	cookie = toy_get_state_synchronize_rcu();
+
+	pthread_mutex_lock(&toy_rcu_cb_mutex);
+	if (ULONG_CMP_LT(toy_rcu_gp_needed, cookie)) {
+		toy_rcu_gp_needed = cookie;
+		pthread_cond_signal(&toy_rcu_cb_cond);
+	}
+	pthread_mutex_unlock(&toy_rcu_cb_mutex);
+
+	return cookie;
+}
+
+void toy_call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+	head->func = func;
+	head->next = NULL;
+
+	pthread_mutex_lock(&toy_rcu_cb_mutex);
+	*toy_rcu_cb_tail = head;
+	toy_rcu_cb_tail = &head->next;
+	pthread_cond_signal(&toy_rcu_cb_cond);
+	pthread_mutex_unlock(&toy_rcu_cb_mutex);
+}
+
+static void *toy_rcu_reclaimer_fn(void *arg)
+{
+	struct rcu_head *list;
+	struct rcu_head *next;
+	bool stop;
+
+	pthread_mutex_lock(&toy_rcu_cb_mutex);
+	for (;;) {
+		while (!toy_rcu_cb_head && !toy_rcu_stop &&
+		       toy_poll_state_synchronize_rcu(toy_rcu_gp_needed))
+			pthread_cond_wait(&toy_rcu_cb_cond, &toy_rcu_cb_mutex);
+
+		list = toy_rcu_cb_head;
+		toy_rcu_cb_head = NULL;
+		toy_rcu_cb_tail = &toy_rcu_cb_head;
+		stop = toy_rcu_stop;
+		pthread_mutex_unlock(&toy_rcu_cb_mutex);
+
+		toy_synchronize_rcu();
+
+		for (; list; list = next) {
+			next = list->next;
+			list->func(list);
+		}
+
+		pthread_mutex_lock(&toy_rcu_cb_mutex);
+		/* Nobody queues callbacks anymore once stopped. */
+		if (stop && !toy_rcu_cb_head)
+			break;
+	}
+	pthread_mutex_unlock(&toy_rcu_cb_mutex);
+
+	return NULL;
+}
+
+int toy_rcu_init(void)
+{
+	int err;
+
+	if (membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED)) {
+		pr_err("membarrier: %d\n", errno);
+		return -errno;
+	}
+
+	err = pthread_create(&toy_rcu_reclaimer, NULL, toy_rcu_reclaimer_fn,
+			     NULL);
+	if (err)
+		return -err;
+
+	return 0;
+}
+
+/*
+ * Must be called after the last toy_call_rcu(): it waits for
+ * all queued callbacks to be invoked.
+ */
+void toy_rcu_exit(void)
+{
+	pthread_mutex_lock(&toy_rcu_cb_mutex);
+	toy_rcu_stop = true;
+	pthread_cond_signal(&toy_rcu_cb_cond);
+	pthread_mutex_unlock(&toy_rcu_cb_mutex);
+
+	pthread_join(toy_rcu_reclaimer, NULL);
+}
@@ -7,6 +7,7 @@
 #include <linux/sched.h>
 #include <linux/jiffies.h>
 #include <linux/random.h>
+#include <linux/workqueue.h>
 #include "utils.h"
 
 struct foo {
@@ -19,11 +20,117 @@ DEFINE_SPINLOCK(foo_mutex);
 
 struct foo __rcu *gbl_foo;
 
+/*
+ * call_rcu() never blocks, so a storm of updates can retire
+ * objects much faster than grace periods free them.  Once
+ * high_water retired objects are waiting, updaters stop queueing
+ * and wait for an expedited grace period themselves, which both
+ * throttles them and keeps the memory bounded.
+ */
+static long high_water = 10000;
+module_param(high_water, long, 0644);
+MODULE_PARM_DESC(high_water, "Max retired struct foo waiting for a grace period");
+
+static atomic_long_t foo_outstanding = ATOMIC_LONG_INIT(0);
+
 static void foo_reclaim(struct rcu_head *p)
 {
 	struct foo *fp = container_of(p, struct foo, rcu);
 	pr_info("RECLAIM!\n");
 	kfree(fp);
+	atomic_long_dec(&foo_outstanding);
+}
+
+/*
+ * Bulk reclamation, in the spirit of kfree_rcu() batching:
+ * instead of one call_rcu() per retired struct foo, the retired
+ * pointers are collected in a page-sized array per CPU.  A full
+ * array, or a partially filled one after FOO_BULK_DRAIN_JIFFIES,
+ * is queued with a single call_rcu() and freed with one
+ * kfree_bulk() after the grace period.
+ */
+struct foo_bulk {
+	struct rcu_head rcu;
+	unsigned long nr;
+	void *records[];
+};
+
+#define FOO_BULK_MAX \
+	((PAGE_SIZE - sizeof(struct foo_bulk)) / sizeof(void *))
+#define FOO_BULK_DRAIN_JIFFIES (HZ / 50)
+
+struct foo_bulk_cpu {
+	spinlock_t lock;
+	struct foo_bulk *bulk;
+};
+
+static DEFINE_PER_CPU(struct foo_bulk_cpu, foo_bulk_cpu);
+
+static void foo_bulk_drain(struct work_struct *work);
+static DECLARE_DELAYED_WORK(foo_bulk_work, foo_bulk_drain);
+
+static void foo_bulk_reclaim(struct rcu_head *p)
+{
+	struct foo_bulk *bulk = container_of(p, struct foo_bulk, rcu);
+
+	pr_info("RECLAIM %lu!\n", bulk->nr);
+	kfree_bulk(bulk->nr, bulk->records);
+	atomic_long_sub(bulk->nr, &foo_outstanding);
+	free_page((unsigned long)bulk);
+}
+
+static void foo_bulk_drain(struct work_struct *work)
+{
+	struct foo_bulk_cpu *bc;
+	struct foo_bulk *bulk;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		bc = per_cpu_ptr(&foo_bulk_cpu, cpu);
+
+		spin_lock(&bc->lock);
+		bulk = bc->bulk;
+		bc->bulk = NULL;
+		spin_unlock(&bc->lock);
+
+		if (bulk)
+			call_rcu(&bulk->rcu, foo_bulk_reclaim);
+	}
+}
+
+static void foo_retire(struct foo *fp)
+{
+	struct foo_bulk_cpu *bc;
+	struct foo_bulk *full = NULL;
+	bool queued = true;
+
+	bc = get_cpu_ptr(&foo_bulk_cpu);
+	spin_lock(&bc->lock);
+	if (!bc->bulk) {
+		bc->bulk = (struct foo_bulk *)__get_free_page(GFP_NOWAIT |
+							      __GFP_NOWARN);
+		if (bc->bulk)
+			bc->bulk->nr = 0;
+	}
+	if (bc->bulk) {
+		bc->bulk->records[bc->bulk->nr++] = fp;
+		if (bc->bulk->nr == FOO_BULK_MAX) {
+			full = bc->bulk;
+			bc->bulk = NULL;
+		}
+	} else {
+		queued = false;
+	}
+	spin_unlock(&bc->lock);
+	put_cpu_ptr(&foo_bulk_cpu);
+
+	if (full)
+		call_rcu(&full->rcu, foo_bulk_reclaim);
+	else if (queued)
+		schedule_delayed_work(&foo_bulk_work, FOO_BULK_DRAIN_JIFFIES);
+	else
+		/* No page for the array: fall back to one callback. */
+		call_rcu(&fp->rcu, foo_reclaim);
 }
 
 /*
@@ -70,8 +177,19 @@ void foo_update_a(int new_a)
 	 * to write our own callback.
 	 *
 	 * kfree_rcu(old_fp, rcu);
+	 *
+	 * foo_retire() goes one step further and batches the
+	 * kfree() calls of many updates behind one callback.
 	 */
-	call_rcu(&old_fp->rcu, foo_reclaim);
+	if (atomic_long_read(&foo_outstanding) >= READ_ONCE(high_water)) {
+		pr_info_ratelimited("BACKPRESSURE!\n");
+		synchronize_rcu_expedited();
+		kfree(old_fp);
+		return;
+	}
+
+	atomic_long_inc(&foo_outstanding);
+	foo_retire(old_fp);
 
 	//END_THREAD;
 }
@@ -157,6 +275,11 @@ static int kthread_writer(void *arg)
 
 static int init_foo(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(&foo_bulk_cpu, cpu)->lock);
+
 	gbl_foo = kmalloc(sizeof(*gbl_foo), GFP_KERNEL);
 	if (!gbl_foo)
 		return -1;
@@ -224,8 +347,12 @@ static void __exit exit_sample_(void)
 	for (i = 0; i < NUM_THREADS; i++)
 		kthread_stop(k[i]);
 
-	kfree(gbl_foo);
+	cancel_delayed_work_sync(&foo_bulk_work);
+	foo_bulk_drain(NULL);
+	/* Wait for the callbacks before the module text goes away. */
+	rcu_barrier();
 
+	kfree(gbl_foo);
 
 	pr_info("--- RCU sample stop %d---\n", i);
 }
@@ -0,0 +1,683 @@
+/* The sample of an RCU-protected resizable hash table
+ *
+ * Many keyed struct foo instead of the single gbl_foo: lookups
+ * are lockless under rcu_read_lock(), updates take a per-bucket
+ * spinlock and use the same copy/publish/retire idiom as
+ * foo_update_a() in the other samples.
+ *
+ * Resizing happens in the background without blocking readers.
+ * Every struct foo has two sets of list pointers, so it can be
+ * linked in the current table and in the table being built at
+ * the same time:
+ *
+ * 1. The new table is published as future_tbl, and a grace
+ *    period makes sure every updater knows about it.
+ * 2. The old buckets are migrated one by one: under the old
+ *    bucket lock, each entry is also linked into the new table
+ *    and the old bucket is marked as migrated.  From then on,
+ *    the new table is authoritative for the keys of that bucket:
+ *    updaters insert there, and readers that miss in the current
+ *    table look into future_tbl as well.
+ * 3. The new table is published as tbl, and after a grace period
+ *    nobody uses the old table anymore and it is freed.
+ *
+ * e.g. insmod sample_hashtable.ko nreaders=8 resize=1 duration=10
+ * Results are in /sys/kernel/debug/foo_hashtable/results.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+#include <linux/random.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+
+static int nreaders = 2;
+module_param(nreaders, int, 0444);
+MODULE_PARM_DESC(nreaders, "Number of lookup threads");
+
+static int nkeys = 4096;
+module_param(nkeys, int, 0444);
+MODULE_PARM_DESC(nkeys, "Number of keys in the table");
+
+static bool resize = true;
+module_param(resize, bool, 0444);
+MODULE_PARM_DESC(resize, "Keep resizing the table while the bench runs");
+
+static int duration = 10;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Bench duration in seconds");
+
+#define FOO_HT_MIN_BITS 4
+#define FOO_HT_MAX_BITS 20
+
+struct foo {
+	unsigned long key;
+	int a;
+	char b;
+	long c;
+	/* One set of list pointers per table generation. */
+	struct hlist_node node[2];
+	/* Id of the table each node is linked in, 0 if none. */
+	unsigned long tbl_id[2];
+	struct rcu_head rcu;
+};
+
+struct foo_bucket {
+	spinlock_t lock;
+	bool migrated;
+	struct hlist_head head;
+};
+
+struct foo_table {
+	unsigned long id;
+	int gen;
+	unsigned int bits;
+	struct foo_bucket buckets[];
+};
+
+static struct foo_table __rcu *foo_tbl;
+static struct foo_table __rcu *foo_future_tbl;
+static DEFINE_MUTEX(foo_resize_mutex);
+static unsigned long foo_tbl_next_id;
+static atomic_t foo_nelems = ATOMIC_INIT(0);
+static atomic_long_t foo_resizes = ATOMIC_LONG_INIT(0);
+
+static void foo_resize_worker(struct work_struct *work);
+static DECLARE_WORK(foo_resize_work, foo_resize_worker);
+
+static struct foo *foo_entry(struct hlist_node *n, int gen)
+{
+	return container_of(n - gen, struct foo, node[0]);
+}
+
+/* Usable under rcu_read_lock() or with the bucket lock held. */
+#define foo_for_each(n, b)						\
+	for (n = rcu_dereference_check(hlist_first_rcu(&(b)->head),	\
+				       lockdep_is_held(&(b)->lock));	\
+	     n;								\
+	     n = rcu_dereference_check(hlist_next_rcu(n),		\
+				       lockdep_is_held(&(b)->lock)))
+
+static struct foo_bucket *foo_bucket(struct foo_table *t, unsigned long key)
+{
+	return &t->buckets[hash_long(key, t->bits)];
+}
+
+static struct foo *foo_find(struct foo_table *t, unsigned long key)
+{
+	struct foo_bucket *b = foo_bucket(t, key);
+	struct hlist_node *n;
+	struct foo *fp;
+
+	foo_for_each(n, b) {
+		fp = foo_entry(n, t->gen);
+		if (fp->key == key)
+			return fp;
+	}
+
+	return NULL;
+}
+
+static bool foo_linked(struct foo *fp, struct foo_table *t)
+{
+	return fp->tbl_id[t->gen] == t->id;
+}
+
+static void foo_link(struct foo *fp, struct foo_table *t)
+{
+	hlist_add_head_rcu(&fp->node[t->gen], &foo_bucket(t, fp->key)->head);
+	fp->tbl_id[t->gen] = t->id;
+}
+
+static void foo_unlink(struct foo *fp, struct foo_table *t)
+{
+	hlist_del_rcu(&fp->node[t->gen]);
+	fp->tbl_id[t->gen] = 0;
+}
+
+static struct foo_table *foo_table_alloc(unsigned int bits, int gen)
+{
+	struct foo_table *t;
+	unsigned int i;
+
+	t = kvzalloc(struct_size(t, buckets, 1U << bits), GFP_KERNEL);
+	if (!t)
+		return NULL;
+
+	t->id = ++foo_tbl_next_id;
+	t->gen = gen;
+	t->bits = bits;
+	for (i = 0; i < (1U << bits); i++) {
+		spin_lock_init(&t->buckets[i].lock);
+		INIT_HLIST_HEAD(&t->buckets[i].head);
+	}
+
+	return t;
+}
+
+/*
+ * Return the value of field "a" of the struct foo with the given
+ * key.  Entries of a migrated bucket may only be in future_tbl,
+ * so look there too on a miss.
+ */
+static bool foo_get_a(unsigned long key, int *a)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+	struct foo *fp;
+
+	rcu_read_lock();
+	t = rcu_dereference(foo_tbl);
+	fp = foo_find(t, key);
+	if (!fp) {
+		f = rcu_dereference(foo_future_tbl);
+		if (f && f != t)
+			fp = foo_find(f, key);
+	}
+	if (fp)
+		*a = fp->a;
+	rcu_read_unlock();
+
+	return fp;
+}
+
+/*
+ * Lock the bucket of key in the current table and, once that
+ * bucket has been migrated, in future_tbl as well.  *fp is set to
+ * the table that is authoritative for the key: updates must be
+ * done there, and mirrored in the current table for the entries
+ * still linked in it.  Must be called under rcu_read_lock().
+ */
+static void foo_lock(unsigned long key, struct foo_table **tp,
+		     struct foo_table **fp)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+
+	t = rcu_dereference(foo_tbl);
+	spin_lock(&foo_bucket(t, key)->lock);
+
+	f = rcu_dereference(foo_future_tbl);
+	if (f && f != t && foo_bucket(t, key)->migrated)
+		spin_lock_nested(&foo_bucket(f, key)->lock,
+				 SINGLE_DEPTH_NESTING);
+	else
+		f = t;
+
+	*tp = t;
+	*fp = f;
+}
+
+static void foo_unlock(unsigned long key, struct foo_table *t,
+		       struct foo_table *f)
+{
+	if (f != t)
+		spin_unlock(&foo_bucket(f, key)->lock);
+	spin_unlock(&foo_bucket(t, key)->lock);
+}
+
+static void foo_maybe_resize(void)
+{
+	unsigned int bits;
+	int n;
+
+	rcu_read_lock();
+	bits = rcu_dereference(foo_tbl)->bits;
+	rcu_read_unlock();
+
+	n = atomic_read(&foo_nelems);
+	if ((n > (1 << bits) / 4 * 3 && bits < FOO_HT_MAX_BITS) ||
+	    (n < (1 << bits) / 10 * 3 && bits > FOO_HT_MIN_BITS))
+		schedule_work(&foo_resize_work);
+}
+
+static int foo_insert(unsigned long key, int a)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+	struct foo *fp;
+	int err = 0;
+
+	fp = kzalloc(sizeof(*fp), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+
+	fp->key = key;
+	fp->a = a;
+
+	rcu_read_lock();
+	foo_lock(key, &t, &f);
+	if (foo_find(f, key))
+		err = -EEXIST;
+	else
+		foo_link(fp, f);
+	foo_unlock(key, t, f);
+	rcu_read_unlock();
+
+	if (err) {
+		kfree(fp);
+		return err;
+	}
+
+	atomic_inc(&foo_nelems);
+	foo_maybe_resize();
+
+	return 0;
+}
+
+static int foo_delete(unsigned long key)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+	struct foo *fp;
+
+	rcu_read_lock();
+	foo_lock(key, &t, &f);
+	fp = foo_find(f, key);
+	if (fp) {
+		foo_unlink(fp, f);
+		if (f != t && foo_linked(fp, t))
+			foo_unlink(fp, t);
+	}
+	foo_unlock(key, t, f);
+	rcu_read_unlock();
+
+	if (!fp)
+		return -ENOENT;
+
+	atomic_dec(&foo_nelems);
+	kfree_rcu(fp, rcu);
+	foo_maybe_resize();
+
+	return 0;
+}
+
+/*
+ * Create a new struct foo that is the same as the one with the
+ * given key, except that field "a" is replaced with "new_a", and
+ * replace the old one with it in every table it is linked in.
+ * The old structure is freed after a grace period.
+ */
+static int foo_update_a(unsigned long key, int new_a)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+	struct foo *new_fp;
+	struct foo *old_fp;
+
+	new_fp = kmalloc(sizeof(*new_fp), GFP_KERNEL);
+	if (!new_fp)
+		return -ENOMEM;
+
+	rcu_read_lock();
+	foo_lock(key, &t, &f);
+	old_fp = foo_find(f, key);
+	if (old_fp) {
+		*new_fp = *old_fp;
+		new_fp->a = new_a;
+		new_fp->tbl_id[0] = 0;
+		new_fp->tbl_id[1] = 0;
+
+		hlist_replace_rcu(&old_fp->node[f->gen], &new_fp->node[f->gen]);
+		new_fp->tbl_id[f->gen] = f->id;
+		if (f != t && foo_linked(old_fp, t)) {
+			hlist_replace_rcu(&old_fp->node[t->gen],
+					  &new_fp->node[t->gen]);
+			new_fp->tbl_id[t->gen] = t->id;
+		}
+	}
+	foo_unlock(key, t, f);
+	rcu_read_unlock();
+
+	if (!old_fp) {
+		kfree(new_fp);
+		return -ENOENT;
+	}
+
+	kfree_rcu(old_fp, rcu);
+
+	return 0;
+}
+
+/* Link every entry of old bucket b into f as well. */
+static void foo_migrate_bucket(struct foo_table *t, struct foo_bucket *b,
+			       struct foo_table *f)
+{
+	struct foo_bucket *fb;
+	struct hlist_node *n;
+	struct foo *fp;
+
+	spin_lock(&b->lock);
+	foo_for_each(n, b) {
+		fp = foo_entry(n, t->gen);
+		if (foo_linked(fp, f))
+			continue;
+
+		fb = foo_bucket(f, fp->key);
+		spin_lock_nested(&fb->lock, SINGLE_DEPTH_NESTING);
+		foo_link(fp, f);
+		spin_unlock(&fb->lock);
+	}
+	b->migrated = true;
+	spin_unlock(&b->lock);
+}
+
+static int foo_resize(unsigned int bits)
+{
+	struct foo_table *t;
+	struct foo_table *f;
+	unsigned int i;
+
+	bits = clamp_t(unsigned int, bits, FOO_HT_MIN_BITS, FOO_HT_MAX_BITS);
+
+	mutex_lock(&foo_resize_mutex);
+	t = rcu_dereference_protected(foo_tbl,
+				      lockdep_is_held(&foo_resize_mutex));
+	if (t->bits == bits) {
+		mutex_unlock(&foo_resize_mutex);
+		return 0;
+	}
+
+	f = foo_table_alloc(bits, !t->gen);
+	if (!f) {
+		mutex_unlock(&foo_resize_mutex);
+		return -ENOMEM;
+	}
+
+	/* 1. Every updater from now on knows about the new table. */
+	rcu_assign_pointer(foo_future_tbl, f);
+	synchronize_rcu();
+
+	/* 2. Migrate incrementally, readers are never blocked. */
+	for (i = 0; i < (1U << t->bits); i++) {
+		foo_migrate_bucket(t, &t->buckets[i], f);
+		cond_resched();
+	}
+
+	/* 3. Switch over and wait for the users of the old table. */
+	rcu_assign_pointer(foo_tbl, f);
+	synchronize_rcu();
+	RCU_INIT_POINTER(foo_future_tbl, NULL);
+	mutex_unlock(&foo_resize_mutex);
+
+	kvfree(t);
+	atomic_long_inc(&foo_resizes);
+
+	return 0;
+}
+
+static void foo_resize_worker(struct work_struct *work)
+{
+	struct foo_table *t;
+	unsigned int bits;
+	int n;
+
+	rcu_read_lock();
+	t = rcu_dereference(foo_tbl);
+	bits = t->bits;
+	rcu_read_unlock();
+
+	n = atomic_read(&foo_nelems);
+	if (n > (1 << bits) / 4 * 3)
+		foo_resize(bits + 1);
+	else if (n < (1 << bits) / 10 * 3)
+		foo_resize(bits - 1);
+}
+
+static int init_foo(void)
+{
+	struct foo_table *t;
+	int err;
+	int i;
+
+	t = foo_table_alloc(FOO_HT_MIN_BITS, 0);
+	if (!t)
+		return -ENOMEM;
+	RCU_INIT_POINTER(foo_tbl, t);
+
+	for (i = 0; i < nkeys; i++) {
+		err = foo_insert(i, i);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static void exit_foo(void)
+{
+	struct foo_table *t;
+	struct hlist_node *n;
+	struct hlist_node *tmp;
+	unsigned int i;
+
+	cancel_work_sync(&foo_resize_work);
+
+	t = rcu_dereference_protected(foo_tbl, 1);
+	if (!t)
+		return;
+
+	for (i = 0; i < (1U << t->bits); i++)
+		hlist_for_each_safe(n, tmp, &t->buckets[i].head)
+			kfree(foo_entry(n, t->gen));
+	kvfree(t);
+
+	/* Wait for the kfree_rcu() of the updates. */
+	rcu_barrier();
+}
+
+/* Bench */
+
+struct foo_thread {
+	struct task_struct *task;
+	u64 ops;
+	u64 hits;
+	u64 elapsed_ns;
+	bool done;
+};
+
+enum { FOO_READER, FOO_WRITER, FOO_RESIZER };
+
+static struct foo_thread *threads;
+static int nthreads;
+static struct dentry *foo_dir;
+
+static void foo_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int foo_role(struct foo_thread *ft)
+{
+	int i = ft - threads;
+
+	if (i < nreaders)
+		return FOO_READER;
+	if (i == nreaders)
+		return FOO_WRITER;
+	return FOO_RESIZER;
+}
+
+static int kthread_bench(void *arg)
+{
+	struct foo_thread *ft = arg;
+	unsigned long end = jiffies + duration * HZ;
+	u64 start = ktime_get_ns();
+	int role = foo_role(ft);
+	bool grow = true;
+	u32 seed = get_random_u32();
+	int a;
+
+	while (time_before(jiffies, end) && !kthread_should_stop()) {
+		seed = next_pseudo_random32(seed);
+
+		switch (role) {
+		case FOO_READER:
+			ft->hits += foo_get_a(seed % nkeys, &a);
+			if (!(ft->ops & 0x3ff))
+				cond_resched();
+			break;
+		case FOO_WRITER:
+			if (ft->ops & 0xf) {
+				foo_update_a(seed % nkeys, seed);
+			} else {
+				/* Exercise the insert and delete paths too. */
+				foo_delete(seed % nkeys);
+				foo_insert(seed % nkeys, seed);
+			}
+			cond_resched();
+			break;
+		case FOO_RESIZER:
+			/* Bounce between an oversized and a crowded table. */
+			foo_resize(grow ? ilog2(nkeys) + 2 : ilog2(nkeys) - 1);
+			grow = !grow;
+			break;
+		}
+		ft->ops++;
+	}
+
+	ft->elapsed_ns = ktime_get_ns() - start;
+	smp_store_release(&ft->done, true);
+
+	foo_park();
+	return 0;
+}
+
+static u64 foo_rate(struct foo_thread *ft, u64 count)
+{
+	u64 us = div_u64(ft->elapsed_ns, NSEC_PER_USEC) ?: 1;
+
+	return div64_u64(count * USEC_PER_SEC, us);
+}
+
+static int foo_results_show(struct seq_file *m, void *v)
+{
+	u64 lookups = 0;
+	u64 hits = 0;
+	u64 updates = 0;
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		struct foo_thread *ft = &threads[i];
+
+		if (!smp_load_acquire(&ft->done)) {
+			seq_puts(m, "state: running\n");
+			return 0;
+		}
+		switch (foo_role(ft)) {
+		case FOO_READER:
+			lookups += foo_rate(ft, ft->ops);
+			hits += ft->hits;
+			break;
+		case FOO_WRITER:
+			updates += foo_rate(ft, ft->ops);
+			break;
+		}
+	}
+
+	seq_puts(m, "state: done\n");
+	seq_printf(m, "readers: %d keys: %d resize: %d duration: %ds\n",
+		   nreaders, nkeys, resize, duration);
+	seq_printf(m, "lookups/sec: %llu\n", lookups);
+	seq_printf(m, "hits: %llu\n", hits);
+	seq_printf(m, "updates/sec: %llu\n", updates);
+	seq_printf(m, "resizes: %ld\n", atomic_long_read(&foo_resizes));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(foo_results);
+
+static void stop_kthreads(void)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		if (threads[i].task)
+			kthread_stop(threads[i].task);
+	kfree(threads);
+}
+
+static int init_kthread(void)
+{
+	struct foo_thread *ft;
+	int err;
+	int i;
+
+	nthreads = nreaders + 1 + resize;
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nthreads; i++) {
+		ft = &threads[i];
+		ft->task = kthread_run(kthread_bench, ft, "foo ht %d", i);
+		if (IS_ERR(ft->task)) {
+			err = PTR_ERR(ft->task);
+			ft->task = NULL;
+			stop_kthreads();
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int __init init_sample_(void)
+{
+	int err;
+
+	if (nreaders < 0 || nkeys <= 0 || duration <= 0)
+		return -EINVAL;
+
+	err = init_foo();
+	if (err)
+		goto out;
+
+	err = init_kthread();
+	if (err)
+		goto out;
+
+	/* Only once threads[] is fully set up. */
+	foo_dir = debugfs_create_dir("foo_hashtable", NULL);
+	debugfs_create_file("results", 0444, foo_dir, NULL,
+			    &foo_results_fops);
+
+	pr_info("------------------------\n");
+	pr_info("--- RCU hash table sample start ---\n");
+
+	return 0;
+
+out:
+	exit_foo();
+	return err;
+}
+
+static void __exit exit_sample_(void)
+{
+	/* No reader of results may see threads[] freed. */
+	debugfs_remove_recursive(foo_dir);
+	stop_kthreads();
+	exit_foo();
+
+	pr_info("--- RCU hash table sample stop ---\n");
+}
+
+MODULE_AUTHOR("Fumiya Shigemitsu");
+MODULE_DESCRIPTION("sample: RCU-protected resizable hash table");
+MODULE_LICENSE("GPL");
+
+module_init(init_sample_)
+module_exit(exit_sample_)
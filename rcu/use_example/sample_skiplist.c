@@ -0,0 +1,640 @@
+/* The sample of an RCU-protected skiplist
+ *
+ * Keyed struct foo kept in key order, for range lookups.  Readers
+ * walk the list under rcu_read_lock() only.  Updaters take one
+ * spinlock per level, and only while they change that level:
+ *
+ * - insert links the new node at level 0 first and then climbs
+ *   up level by level, so a reader that finds it on some level
+ *   always finds it below too.
+ * - delete marks the node dead under the level 0 lock, which is
+ *   the point where it disappears for readers, then unlinks it
+ *   from the top level down to level 0 and frees it with
+ *   call_rcu() like sample_call_rcu.c does.
+ *
+ * Each node records in a bitmask the levels it is linked on.  The
+ * bit of a level only changes under that level's lock, which is
+ * how an updater holding the lock knows whether a node it reached
+ * from the level above is still a valid place to continue from.
+ *
+ * The module benchmarks range scans against an rbtree protected
+ * by a rwlock, with one thread deleting and reinserting keys:
+ * e.g. insmod sample_skiplist.ko mode=skiplist nreaders=8 range=64
+ * Results are in /sys/kernel/debug/foo_skiplist/results.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+
+static char *mode = "skiplist";
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "skiplist or rbtree");
+
+static int nreaders = 2;
+module_param(nreaders, int, 0444);
+MODULE_PARM_DESC(nreaders, "Number of range-scan threads");
+
+static int nkeys = 4096;
+module_param(nkeys, int, 0444);
+MODULE_PARM_DESC(nkeys, "Number of keys");
+
+static int range = 64;
+module_param(range, int, 0444);
+MODULE_PARM_DESC(range, "Width of the key range of each scan");
+
+static int duration = 10;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Bench duration in seconds");
+
+/* skiplist */
+
+#define SL_MAX_LEVEL 16
+
+struct foo {
+	unsigned long key;
+	int a;
+	char b;
+	long c;
+	bool dead;
+	int height;
+	/* Bit n set while linked on level n. */
+	unsigned long levels;
+	struct rcu_head rcu;
+	struct foo __rcu *next[];
+};
+
+static struct foo *sl_head;
+static spinlock_t sl_lock[SL_MAX_LEVEL];
+
+static void foo_reclaim(struct rcu_head *p)
+{
+	struct foo *fp = container_of(p, struct foo, rcu);
+
+	kfree(fp);
+}
+
+static int sl_random_height(void)
+{
+	int height = 1;
+
+	/* P(height > n) = 1/4^n */
+	while (height < SL_MAX_LEVEL && !(get_random_u32() & 0x3))
+		height++;
+
+	return height;
+}
+
+static bool sl_on_level(struct foo *x, int lvl)
+{
+	return x == sl_head || test_bit(lvl, &x->levels);
+}
+
+/*
+ * Return the last node on level lvl that is before key, or before
+ * node if it is given (nodes may share a key while one of them is
+ * dead).  The caller holds sl_lock[lvl] and rcu_read_lock(): the
+ * levels above are walked without their lock, so start over when
+ * they lead to a node that has left level lvl in the meantime.
+ */
+static struct foo *sl_pred(unsigned long key, struct foo *node, int lvl)
+{
+	struct foo *x;
+	struct foo *nx;
+	int i;
+
+retry:
+	x = sl_head;
+	for (i = SL_MAX_LEVEL - 1; i >= lvl; i--) {
+		if (i == lvl && !sl_on_level(x, lvl))
+			goto retry;
+		while ((nx = rcu_dereference(x->next[i])) && nx->key < key)
+			x = nx;
+	}
+
+	if (node)
+		while ((nx = rcu_dereference(x->next[lvl])) && nx != node)
+			x = nx;
+
+	return x;
+}
+
+static int sl_insert(unsigned long key, int a)
+{
+	struct foo *fp;
+	struct foo *pred;
+	struct foo *nx;
+	int lvl;
+
+	fp = kzalloc(struct_size(fp, next, SL_MAX_LEVEL), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+
+	fp->key = key;
+	fp->a = a;
+	fp->height = sl_random_height();
+
+	/* Keeps fp alive if it gets deleted while climbing up. */
+	rcu_read_lock();
+
+	for (;;) {
+		spin_lock(&sl_lock[0]);
+		pred = sl_pred(key, NULL, 0);
+		nx = rcu_dereference(pred->next[0]);
+		if (!nx || nx->key != key)
+			break;
+		spin_unlock(&sl_lock[0]);
+		if (!READ_ONCE(nx->dead)) {
+			rcu_read_unlock();
+			kfree(fp);
+			return -EEXIST;
+		}
+		/* The dead one is about to be unlinked, wait for it. */
+		cpu_relax();
+	}
+	RCU_INIT_POINTER(fp->next[0], nx);
+	rcu_assign_pointer(pred->next[0], fp);
+	set_bit(0, &fp->levels);
+	spin_unlock(&sl_lock[0]);
+
+	for (lvl = 1; lvl < fp->height; lvl++) {
+		spin_lock(&sl_lock[lvl]);
+		if (READ_ONCE(fp->dead)) {
+			spin_unlock(&sl_lock[lvl]);
+			break;
+		}
+		pred = sl_pred(key, NULL, lvl);
+		RCU_INIT_POINTER(fp->next[lvl], rcu_dereference(pred->next[lvl]));
+		rcu_assign_pointer(pred->next[lvl], fp);
+		set_bit(lvl, &fp->levels);
+		spin_unlock(&sl_lock[lvl]);
+	}
+
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static void sl_unlink(struct foo *fp, int lvl)
+{
+	struct foo *pred;
+
+	spin_lock(&sl_lock[lvl]);
+	if (test_bit(lvl, &fp->levels)) {
+		pred = sl_pred(fp->key, fp, lvl);
+		rcu_assign_pointer(pred->next[lvl],
+				   rcu_dereference(fp->next[lvl]));
+		clear_bit(lvl, &fp->levels);
+	}
+	spin_unlock(&sl_lock[lvl]);
+}
+
+static int sl_delete(unsigned long key)
+{
+	struct foo *pred;
+	struct foo *fp;
+	int lvl;
+
+	rcu_read_lock();
+
+	spin_lock(&sl_lock[0]);
+	pred = sl_pred(key, NULL, 0);
+	/* Skip the dead nodes with the same key. */
+	while ((fp = rcu_dereference(pred->next[0])) && fp->key == key &&
+	       fp->dead)
+		pred = fp;
+	if (!fp || fp->key != key) {
+		spin_unlock(&sl_lock[0]);
+		rcu_read_unlock();
+		return -ENOENT;
+	}
+	WRITE_ONCE(fp->dead, true);
+	spin_unlock(&sl_lock[0]);
+
+	/*
+	 * Top-down, so that a reader coming from an upper level can
+	 * still follow the level 0 pointer of fp.
+	 */
+	for (lvl = fp->height - 1; lvl >= 0; lvl--)
+		sl_unlink(fp, lvl);
+
+	rcu_read_unlock();
+
+	call_rcu(&fp->rcu, foo_reclaim);
+
+	return 0;
+}
+
+static int sl_scan(unsigned long lo, unsigned long hi, long *sum)
+{
+	struct foo *x = sl_head;
+	struct foo *nx;
+	int n = 0;
+	int lvl;
+
+	rcu_read_lock();
+	for (lvl = SL_MAX_LEVEL - 1; lvl >= 0; lvl--)
+		while ((nx = rcu_dereference(x->next[lvl])) && nx->key < lo)
+			x = nx;
+
+	for (x = rcu_dereference(x->next[0]); x && x->key <= hi;
+	     x = rcu_dereference(x->next[0])) {
+		if (READ_ONCE(x->dead))
+			continue;
+		*sum += x->a;
+		n++;
+	}
+	rcu_read_unlock();
+
+	return n;
+}
+
+static int sl_init(void)
+{
+	int i;
+
+	for (i = 0; i < SL_MAX_LEVEL; i++)
+		spin_lock_init(&sl_lock[i]);
+
+	sl_head = kzalloc(struct_size(sl_head, next, SL_MAX_LEVEL), GFP_KERNEL);
+	if (!sl_head)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void sl_exit(void)
+{
+	struct foo *x;
+	struct foo *nx;
+
+	if (!sl_head)
+		return;
+
+	for (x = rcu_dereference_protected(sl_head->next[0], 1); x; x = nx) {
+		nx = rcu_dereference_protected(x->next[0], 1);
+		kfree(x);
+	}
+	kfree(sl_head);
+
+	/* Wait for the call_rcu() of the deletes. */
+	rcu_barrier();
+}
+
+/* rbtree: the same records under a rwlock */
+
+struct foo_rb {
+	struct rb_node node;
+	unsigned long key;
+	int a;
+};
+
+static struct rb_root rb_foo = RB_ROOT;
+static DEFINE_RWLOCK(rb_lock);
+
+static int rb_insert(unsigned long key, int a)
+{
+	struct rb_node **link = &rb_foo.rb_node;
+	struct rb_node *parent = NULL;
+	struct foo_rb *fp;
+	struct foo_rb *x;
+
+	fp = kzalloc(sizeof(*fp), GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+
+	fp->key = key;
+	fp->a = a;
+
+	write_lock(&rb_lock);
+	while (*link) {
+		parent = *link;
+		x = rb_entry(parent, struct foo_rb, node);
+		if (key < x->key) {
+			link = &parent->rb_left;
+		} else if (key > x->key) {
+			link = &parent->rb_right;
+		} else {
+			write_unlock(&rb_lock);
+			kfree(fp);
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&fp->node, parent, link);
+	rb_insert_color(&fp->node, &rb_foo);
+	write_unlock(&rb_lock);
+
+	return 0;
+}
+
+static struct foo_rb *rb_first_ge(unsigned long key)
+{
+	struct rb_node *n = rb_foo.rb_node;
+	struct foo_rb *ge = NULL;
+	struct foo_rb *x;
+
+	while (n) {
+		x = rb_entry(n, struct foo_rb, node);
+		if (x->key >= key) {
+			ge = x;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return ge;
+}
+
+static int rb_delete(unsigned long key)
+{
+	struct foo_rb *fp;
+
+	write_lock(&rb_lock);
+	fp = rb_first_ge(key);
+	if (!fp || fp->key != key) {
+		write_unlock(&rb_lock);
+		return -ENOENT;
+	}
+	rb_erase(&fp->node, &rb_foo);
+	write_unlock(&rb_lock);
+
+	kfree(fp);
+
+	return 0;
+}
+
+static int rb_scan(unsigned long lo, unsigned long hi, long *sum)
+{
+	struct rb_node *n;
+	struct foo_rb *x;
+	int cnt = 0;
+
+	read_lock(&rb_lock);
+	x = rb_first_ge(lo);
+	for (n = x ? &x->node : NULL; n; n = rb_next(n)) {
+		x = rb_entry(n, struct foo_rb, node);
+		if (x->key > hi)
+			break;
+		*sum += x->a;
+		cnt++;
+	}
+	read_unlock(&rb_lock);
+
+	return cnt;
+}
+
+static void rb_exit(void)
+{
+	struct foo_rb *x;
+	struct foo_rb *n;
+
+	rbtree_postorder_for_each_entry_safe(x, n, &rb_foo, node)
+		kfree(x);
+	rb_foo = RB_ROOT;
+}
+
+struct foo_ops {
+	const char *name;
+	int (*init)(void);
+	void (*exit)(void);
+	int (*insert)(unsigned long key, int a);
+	int (*delete)(unsigned long key);
+	int (*scan)(unsigned long lo, unsigned long hi, long *sum);
+};
+
+static struct foo_ops sl_ops = {
+	.name	= "skiplist",
+	.init	= sl_init,
+	.exit	= sl_exit,
+	.insert	= sl_insert,
+	.delete	= sl_delete,
+	.scan	= sl_scan,
+};
+
+static struct foo_ops rb_ops = {
+	.name	= "rbtree",
+	.exit	= rb_exit,
+	.insert	= rb_insert,
+	.delete	= rb_delete,
+	.scan	= rb_scan,
+};
+
+static struct foo_ops *cur_ops;
+
+/* Bench */
+
+struct foo_thread {
+	struct task_struct *task;
+	bool writer;
+	u64 ops;
+	u64 keys;
+	u64 elapsed_ns;
+	long sink;
+	bool done;
+};
+
+static struct foo_thread *threads;
+static int nthreads;
+static struct dentry *foo_dir;
+
+static void foo_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int kthread_bench(void *arg)
+{
+	struct foo_thread *ft = arg;
+	unsigned long end = jiffies + duration * HZ;
+	u64 start = ktime_get_ns();
+	u32 seed = get_random_u32();
+	unsigned long key;
+	long sum = 0;
+
+	while (time_before(jiffies, end) && !kthread_should_stop()) {
+		seed = next_pseudo_random32(seed);
+		key = seed % nkeys;
+
+		if (ft->writer) {
+			cur_ops->delete(key);
+			cur_ops->insert(key, seed);
+			cond_resched();
+		} else {
+			ft->keys += cur_ops->scan(key, key + range - 1, &sum);
+			if (!(ft->ops & 0xff))
+				cond_resched();
+		}
+		ft->ops++;
+	}
+
+	ft->elapsed_ns = ktime_get_ns() - start;
+	ft->sink = sum;
+	smp_store_release(&ft->done, true);
+
+	foo_park();
+	return 0;
+}
+
+static u64 foo_rate(struct foo_thread *ft, u64 count)
+{
+	u64 us = div_u64(ft->elapsed_ns, NSEC_PER_USEC) ?: 1;
+
+	return div64_u64(count * USEC_PER_SEC, us);
+}
+
+static int foo_results_show(struct seq_file *m, void *v)
+{
+	u64 scans = 0;
+	u64 keys = 0;
+	u64 updates = 0;
+	int i;
+
+	for (i = 0; i < nthreads; i++) {
+		struct foo_thread *ft = &threads[i];
+
+		if (!smp_load_acquire(&ft->done)) {
+			seq_puts(m, "state: running\n");
+			return 0;
+		}
+		if (ft->writer) {
+			updates += foo_rate(ft, ft->ops);
+		} else {
+			scans += foo_rate(ft, ft->ops);
+			keys += foo_rate(ft, ft->keys);
+		}
+	}
+
+	seq_puts(m, "state: done\n");
+	seq_printf(m, "mode: %s\n", cur_ops->name);
+	seq_printf(m, "readers: %d keys: %d range: %d duration: %ds\n",
+		   nreaders, nkeys, range, duration);
+	seq_printf(m, "scans/sec: %llu\n", scans);
+	seq_printf(m, "keys/sec: %llu\n", keys);
+	seq_printf(m, "updates/sec: %llu\n", updates);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(foo_results);
+
+static void stop_kthreads(void)
+{
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		if (threads[i].task)
+			kthread_stop(threads[i].task);
+	kfree(threads);
+}
+
+static int init_kthread(void)
+{
+	struct foo_thread *ft;
+	int err;
+	int i;
+
+	nthreads = nreaders + 1;
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nthreads; i++) {
+		ft = &threads[i];
+		ft->writer = i == nreaders;
+		ft->task = kthread_run(kthread_bench, ft, "foo %s %d",
+				       ft->writer ? "writer" : "scanner", i);
+		if (IS_ERR(ft->task)) {
+			err = PTR_ERR(ft->task);
+			ft->task = NULL;
+			stop_kthreads();
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int init_foo(void)
+{
+	int err;
+	int i;
+
+	if (cur_ops->init) {
+		err = cur_ops->init();
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		err = cur_ops->insert(i, i);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int __init init_sample_(void)
+{
+	int err;
+
+	if (!strcmp(mode, sl_ops.name))
+		cur_ops = &sl_ops;
+	else if (!strcmp(mode, rb_ops.name))
+		cur_ops = &rb_ops;
+	else
+		return -EINVAL;
+
+	if (nreaders < 0 || nkeys <= 0 || range <= 0 || duration <= 0)
+		return -EINVAL;
+
+	err = init_foo();
+	if (err)
+		goto out;
+
+	err = init_kthread();
+	if (err)
+		goto out;
+
+	/* Only once threads[] is fully set up. */
+	foo_dir = debugfs_create_dir("foo_skiplist", NULL);
+	debugfs_create_file("results", 0444, foo_dir, NULL,
+			    &foo_results_fops);
+
+	pr_info("------------------------\n");
+	pr_info("--- RCU skiplist sample start: %s ---\n", cur_ops->name);
+
+	return 0;
+
+out:
+	cur_ops->exit();
+	return err;
+}
+
+static void __exit exit_sample_(void)
+{
+	/* No reader of results may see threads[] freed. */
+	debugfs_remove_recursive(foo_dir);
+	stop_kthreads();
+	cur_ops->exit();
+
+	pr_info("--- RCU skiplist sample stop ---\n");
+}
+
+MODULE_AUTHOR("Fumiya Shigemitsu");
+MODULE_DESCRIPTION("sample: RCU-protected skiplist");
+MODULE_LICENSE("GPL");
+
+module_init(init_sample_)
+module_exit(exit_sample_)
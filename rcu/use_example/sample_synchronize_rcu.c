@@ -7,6 +7,8 @@
 #include <linux/sched.h>
 #include <linux/jiffies.h>
 #include <linux/random.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
 #include "utils.h"
 
 struct foo {
@@ -18,6 +20,68 @@ DEFINE_SPINLOCK(foo_mutex);
 
 struct foo __rcu *gbl_foo;
 
+/*
+ * Update combining
+ *
+ * Concurrent writers do not each copy, publish and retire their
+ * own struct foo.  A writer posts its new value to the slot of
+ * its CPU and then either finds that another writer already
+ * applied it, or becomes the combiner: it collects every posted
+ * value, applies all of them to a single copy and goes through
+ * one publish/synchronize_rcu()/kfree() cycle on behalf of all
+ * writers.  With N concurrent writers this takes one allocation
+ * and one grace period instead of N.
+ *
+ * Writers racing on "a" are concurrent, so the combiner may apply
+ * the posted values in any order, and a value posted on top of a
+ * pending one simply replaces it.
+ *
+ * foo_combine_seq counts combining passes the same way RCU counts
+ * grace periods: the low bit is set while a pass is in progress.
+ * A writer is done once a pass that started after its post has
+ * completed.
+ */
+struct foo_slot {
+	spinlock_t lock;
+	bool pending;
+	int new_a;
+};
+
+static DEFINE_PER_CPU(struct foo_slot, foo_slots);
+static DEFINE_MUTEX(foo_combine_mutex);
+static unsigned long foo_combine_seq;
+
+static void foo_post(int new_a)
+{
+	struct foo_slot *slot;
+
+	/* Any slot will do, the local one is just the cheapest. */
+	slot = raw_cpu_ptr(&foo_slots);
+
+	spin_lock(&slot->lock);
+	slot->new_a = new_a;
+	slot->pending = true;
+	spin_unlock(&slot->lock);
+}
+
+/* Apply every posted value to fp. */
+static void foo_collect(struct foo *fp)
+{
+	struct foo_slot *slot;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		slot = per_cpu_ptr(&foo_slots, cpu);
+
+		spin_lock(&slot->lock);
+		if (slot->pending) {
+			fp->a = slot->new_a;
+			slot->pending = false;
+		}
+		spin_unlock(&slot->lock);
+	}
+}
+
 /*
  * Create a new struct foo that is the same as the one currently
  * pointed to by gbl_foo, except that field "a" is replaced
@@ -35,15 +99,30 @@ void foo_update_a(int new_a)
 {
 	struct foo *new_fp;
 	struct foo *old_fp;
+	unsigned long s;
 
 	//START_THREAD;
 
+	foo_post(new_a);
+
+	/* The end of the first pass that starts after the post. */
+	smp_mb();
+	s = (READ_ONCE(foo_combine_seq) + 3) & ~0x1UL;
+
+	mutex_lock(&foo_combine_mutex);
+	if (ULONG_CMP_GE(foo_combine_seq, s)) {
+		/* Another writer applied our value and waited for us. */
+		mutex_unlock(&foo_combine_mutex);
+		return;
+	}
+	WRITE_ONCE(foo_combine_seq, foo_combine_seq + 1);
+
 	new_fp = kmalloc(sizeof(*new_fp), GFP_KERNEL);
 
 	spin_lock(&foo_mutex);
 	old_fp = rcu_dereference_protected(gbl_foo, lockdep_is_held(&foo_mutex));
 	*new_fp = *old_fp;
-	new_fp->a = new_a;
+	foo_collect(new_fp);
 	rcu_assign_pointer(gbl_foo, new_fp);
 	spin_unlock(&foo_mutex);
 
@@ -57,6 +136,9 @@ void foo_update_a(int new_a)
 	synchronize_rcu();
 	kfree(old_fp);
 
+	WRITE_ONCE(foo_combine_seq, foo_combine_seq + 1);
+	mutex_unlock(&foo_combine_mutex);
+
 	//END_THREAD;
 }
 
@@ -82,7 +164,7 @@ int foo_get_a(void)
 	return retval;
 }
 
-#define NUM_WRITER_THREADS 1
+#define NUM_WRITER_THREADS 4
 #define NUM_READER_THREADS 10
 #define NUM_THREADS (NUM_WRITER_THREADS + NUM_READER_THREADS)
 
@@ -141,6 +223,11 @@ static int kthread_writer(void *arg)
 
 static int init_foo(void)
 {
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(&foo_slots, cpu)->lock);
+
 	gbl_foo = kmalloc(sizeof(*gbl_foo), GFP_KERNEL);
 	if (!gbl_foo)
 		return -1;